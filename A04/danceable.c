@@ -25,9 +25,55 @@ typedef struct Node {
     struct Node *next;
 } Node;
 
+#ifdef USE_SLAB
+#include "../A12/slab.h"
+
+// Nodes and songs all have the same size, so they come from slab pools (make SLAB=1)
+static struct slab_pool *node_pool = NULL;
+static struct slab_pool *song_pool = NULL;
+
+Node* alloc_node() {
+    if (node_pool == NULL) {
+        node_pool = slab_create(sizeof(Node));
+    }
+    return node_pool != NULL ? slab_alloc(node_pool) : NULL;
+}
+
+Song* alloc_song() {
+    if (song_pool == NULL) {
+        song_pool = slab_create(sizeof(Song));
+    }
+    return song_pool != NULL ? slab_alloc(song_pool) : NULL;
+}
+
+void free_node(Node *node) {
+    slab_free(node_pool, node);
+}
+
+void free_song(Song *song) {
+    slab_free(song_pool, song);
+}
+#else
+Node* alloc_node() {
+    return malloc(sizeof(Node));
+}
+
+Song* alloc_song() {
+    return malloc(sizeof(Song));
+}
+
+void free_node(Node *node) {
+    free(node);
+}
+
+void free_song(Song *song) {
+    free(song);
+}
+#endif
+
 // Function to create a new linked list node
 Node* create_node(Song *song) {
-    Node *new_node = malloc(sizeof(Node));
+    Node *new_node = alloc_node();
     new_node->song = song;
     new_node->next = NULL;
     return new_node;
@@ -67,7 +113,7 @@ void load_songs(Node **head, const char *filename) {
 
     while (fgets(line, sizeof(line), file)) {
         // Dynamically allocate memory for a new song
-        Song *song = malloc(sizeof(Song));
+        Song *song = alloc_song();
 
         // Parse each field in the line
         char *token = strtok(line, ",");
@@ -121,8 +167,8 @@ void remove_node(Node **head, Node *target) {
         *head = target->next;
         free(target->song->title);
         free(target->song->artist);
-        free(target->song);
-        free(target);
+        free_song(target->song);
+        free_node(target);
         return;
     }
 
@@ -131,8 +177,8 @@ void remove_node(Node **head, Node *target) {
             prev->next = current->next;
             free(current->song->title);
             free(current->song->artist);
-            free(current->song);
-            free(current);
+            free_song(current->song);
+            free_node(current);
             return;
         }
         prev = current;
@@ -147,8 +193,8 @@ void clear_list(Node *head) {
         Node *next = current->next;
         free(current->song->title);
         free(current->song->artist);
-        free(current->song);
-        free(current);
+        free_song(current->song);
+        free_node(current);
         current = next;
     }
 }
@@ -186,6 +232,10 @@ int main() {
     } while (choice != 'q');
 
     clear_list(song_list);
+#ifdef USE_SLAB
+    slab_destroy(node_pool);
+    slab_destroy(song_pool);
+#endif
 
     return 0;
 }
@@ -0,0 +1,95 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: A small worker pool for running encode/decode over many files in one process.
+ * Workers pull the next file index from a shared counter, so while some of them wait on disk
+ * reads others are busy extracting bits. Results are printed one JSON object per line.
+ ---------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "batch.h"
+
+struct batch_state {
+    int count;
+    int next;  // next index to hand out, claimed atomically
+    void (*job)(int index, void* arg);
+    void* arg;
+};
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* batch_worker(void* data) {
+    struct batch_state* state = data;
+    for (;;) {
+        int index = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED);
+        if (index >= state->count) break;
+        state->job(index, state->arg);
+    }
+    return NULL;
+}
+
+void batch_run(int count, int nthreads, void (*job)(int index, void* arg), void* arg) {
+    struct batch_state state = {count, 0, job, arg};
+    if (nthreads > count) nthreads = count;
+    if (nthreads < 1) nthreads = 1;
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+    int started = 0;
+    if (threads != NULL) {
+        for (; started < nthreads; started++) {
+            if (pthread_create(&threads[started], NULL, batch_worker, &state) != 0) break;
+        }
+    }
+    if (started == 0) {
+        batch_worker(&state);  // no threads available, do the work here
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+double batch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void batch_emit(const char* line) {
+    pthread_mutex_lock(&output_lock);
+    fputs(line, stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&output_lock);
+}
+
+void batch_json_string(char* dst, size_t n, const char* s) {
+    size_t j = 0;
+    // leave room for the closing quote and terminator
+    if (n < 3) {
+        if (n > 0) dst[0] = '\0';
+        return;
+    }
+    dst[j++] = '"';
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        char esc[7];
+        if (c == '"' || c == '\\') {
+            snprintf(esc, sizeof(esc), "\\%c", c);
+        } else if (c < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+        } else {
+            esc[0] = c;
+            esc[1] = '\0';
+        }
+        size_t len = strlen(esc);
+        if (j + len + 2 > n) break;
+        memcpy(dst + j, esc, len);
+        j += len;
+    }
+    dst[j++] = '"';
+    dst[j] = '\0';
+}
@@ -0,0 +1,22 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stddef.h>
+
+// run job(index, arg) once for every index in [0, count) on up to nthreads
+// worker threads; each worker claims the next unprocessed index when it
+// finishes one, so slow files (cold cache, big images) do not stall the rest
+extern void batch_run(int count, int nthreads, void (*job)(int index, void* arg), void* arg);
+
+// returns a monotonic time in seconds
+extern double batch_now(void);
+
+// print line and a newline to stdout as one unit and flush, so lines from
+// different workers never interleave
+extern void batch_emit(const char* line);
+
+// store s in dst as a quoted JSON string, escaping as needed
+// n: size of dst; the result is cut short (but still quoted) if it is too small
+extern void batch_json_string(char* dst, size_t n, const char* s);
+
+#endif
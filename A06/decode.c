@@ -2,65 +2,372 @@
  * Author: Rami Nasr
  * Date: 10/11/2024
  * Description: This program extracts a hidden message from the least significant bits (LSBs) of the red, green,
- * and blue color channels of each pixel in a PPM image. 
- * It reads the image using read_ppm, then decodes the message by combining bits 
- * into characters until the null character (\0) is found
+ * and blue color channels of each pixel in a PPM image.
+ * The file is memory mapped rather than loaded, so only the pages holding the header and the
+ * message are actually read from disk. The bits are combined into characters 8 at a time by
+ * lsb_extract (see lsb.c) until the null character (\0) is found, and the message is printed
+ * with a single write.
+ * With -o, a binary payload written by "encode -f" is recovered instead: the length header is
+ * checked, the payload is extracted in chunks straight into the output file, and its CRC-32 is
+ * compared with the one stored after it. The bits per channel come from the header, and the
+ * extraction is split across -j threads.
+ * With -B, every file named on the command line is scanned by a pool of -j workers (one file per
+ * worker at a time) and a JSON line is printed per file, followed by a summary line. With -o dir,
+ * each payload is written to dir/<index>-<name>.bin, where index is the file's place in the batch.
  * ----------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "read_ppm.h"
+#include "lsb.h"
+#include "stego.h"
+#include "batch.h"
+
+// a multiple of 3 so every chunk ends on a channel group (see lsb.h)
+#define CHUNK_SIZE (3 * 1024 * 1024)
+
+// status codes for extract_payload
+enum payload_status {
+    PAYLOAD_OK = 0,
+    PAYLOAD_NO_HEADER,
+    PAYLOAD_TOO_LONG,
+    PAYLOAD_NOMEM,
+    PAYLOAD_WRITE,
+    PAYLOAD_CRC
+};
+
+static const char* payload_messages[] = {
+    "OK",
+    "No payload header found in this image",
+    "Payload length exceeds the image capacity",
+    "Memory allocation failed",
+    "Cannot write payload",
+    "Payload checksum mismatch"
+};
+
+// a PPM image mapped into memory
+struct mapped_ppm {
+    const unsigned char* file;
+    size_t size;
+    struct ppm_header hdr;
+    const unsigned char* channels;  // first byte of pixel data
+    size_t channel_count;
+};
+
+// map filename and check its header
+// returns a ppm_status code; m is only valid (and must be unmapped) on PPM_OK
+static int map_ppm(const char* filename, struct mapped_ppm* m) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return PPM_ERR_OPEN;
+    }
+    m->size = st.st_size;
+    m->file = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m->file == MAP_FAILED) {
+        return PPM_ERR_OPEN;
+    }
+
+    int status = ppm_parse_header(m->file, m->size, &m->hdr);
+    if (status == PPM_OK) {
+        m->channel_count = (size_t)m->hdr.width * m->hdr.height * sizeof(struct ppm_pixel);
+        m->channels = m->file + m->hdr.data_offset;
+        if (m->size - m->hdr.data_offset < m->channel_count) {
+            status = PPM_ERR_TRUNCATED;
+        }
+    }
+    if (status != PPM_OK) {
+        munmap((void*)m->file, m->size);
+    }
+    return status;
+}
+
+static void unmap_ppm(struct mapped_ppm* m) {
+    munmap((void*)m->file, m->size);
+}
+
+// recover the payload hidden in channels and check its crc
+// out_path: file to write the payload to, or NULL to only check it
+// pool: workers to split the extraction across, or NULL to do it on this thread
+// hdr: receives the payload header
+// returns a payload_status code; the output file is removed on a crc mismatch
+static int extract_payload(const unsigned char* channels, size_t channel_count, const char* out_path,
+                           struct stego_pool* pool, struct stego_header* hdr) {
+    if (channel_count < 8 * STEGO_HEADER_BYTES || stego_read_header(channels, hdr) != 0) {
+        return PAYLOAD_NO_HEADER;
+    }
+    if (hdr->length > stego_capacity(channel_count, hdr->bits)) {
+        return PAYLOAD_TOO_LONG;
+    }
+
+    // While the pool extracts one chunk, this thread checksums and writes the previous one.
+    // Without a pool the extraction is done in place, so one buffer is enough.
+    unsigned char* chunk[2];
+    chunk[0] = malloc(CHUNK_SIZE);
+    chunk[1] = pool ? malloc(CHUNK_SIZE) : chunk[0];
+    if (chunk[0] == NULL || chunk[1] == NULL) {
+        free(chunk[0]);
+        if (pool) free(chunk[1]);
+        return PAYLOAD_NOMEM;
+    }
+    FILE* outfile = NULL;
+    if (out_path != NULL && (outfile = fopen(out_path, "wb")) == NULL) {
+        free(chunk[0]);
+        if (pool) free(chunk[1]);
+        return PAYLOAD_WRITE;
+    }
+
+    uint32_t crc = 0;
+    uint64_t offset = 0;
+    int cur = 0;
+    int failed = 0;
+    size_t n = hdr->length < CHUNK_SIZE ? hdr->length : CHUNK_SIZE;
+    if (n > 0 && pool) {
+        stego_pool_read(pool, channels + stego_channel(0, hdr->bits), chunk[cur], n, hdr->bits);
+    }
+    while (n > 0) {
+        if (pool) {
+            stego_pool_wait(pool);
+        } else {
+            lsb_read_bits(channels + stego_channel(offset, hdr->bits), chunk[cur], n, hdr->bits);
+        }
+        offset += n;
+        uint64_t remaining = hdr->length - offset;
+        size_t next = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+        if (next > 0 && pool) {
+            stego_pool_read(pool, channels + stego_channel(offset, hdr->bits), chunk[!cur], next, hdr->bits);
+        }
+        crc = stego_crc32(crc, chunk[cur], n);
+        if (outfile != NULL && !failed && fwrite(chunk[cur], 1, n, outfile) != n) {
+            failed = 1;
+        }
+        cur = !cur;
+        n = next;
+    }
+    free(chunk[0]);
+    if (pool) free(chunk[1]);
+    if (outfile != NULL && fclose(outfile) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        return PAYLOAD_WRITE;
+    }
+
+    unsigned char trailer[STEGO_TRAILER_BYTES];
+    lsb_read_bits(channels + stego_trailer_channel(hdr->length, hdr->bits), trailer, sizeof(trailer), hdr->bits);
+    uint32_t stored = ((uint32_t)trailer[0] << 24) | (trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+    if (stored != crc) {
+        if (out_path != NULL) unlink(out_path);
+        return PAYLOAD_CRC;
+    }
+    return PAYLOAD_OK;
+}
+
+// settings and totals shared by the batch workers
+struct batch_decode {
+    char** files;
+    const char* out_dir;  // where payloads are written, or NULL
+    int ok;
+    int errors;
+    int payloads;
+    unsigned long long scanned;
+};
+
+// decode one file of a batch and print its JSON line
+static void batch_decode_file(int index, void* arg) {
+    struct batch_decode* batch = arg;
+    const char* filename = batch->files[index];
+    char name[1024];
+    char line[2560];
+    batch_json_string(name, sizeof(name), filename);
+    double start = batch_now();
+
+    struct mapped_ppm m;
+    int status = map_ppm(filename, &m);
+    if (status != PPM_OK) {
+        snprintf(line, sizeof(line), "{\"file\":%s,\"status\":\"error\",\"error\":\"%s\"}",
+            name, ppm_strerror(status));
+        batch_emit(line);
+        __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    // the scan reads the pixel data front to back
+    madvise((void*)m.file, m.size, MADV_SEQUENTIAL);
+
+    char out_path[1024];
+    const char* out = NULL;
+    if (batch->out_dir != NULL) {
+        const char* base = strrchr(filename, '/');
+        base = base ? base + 1 : filename;
+        const char* dot = strrchr(base, '.');
+        int base_len = dot ? (int)(dot - base) : (int)strlen(base);
+        // the index keeps inputs with the same name (or given twice) apart
+        snprintf(out_path, sizeof(out_path), "%s/%d-%.*s.bin", batch->out_dir, index, base_len, base);
+        out = out_path;
+    }
+
+    struct stego_header hdr;
+    int result = extract_payload(m.channels, m.channel_count, out, NULL, &hdr);
+    size_t scanned;
+    int n;
+    if (result == PAYLOAD_NO_HEADER) {
+        // no payload, report the text message instead
+        size_t max_chars = m.channel_count / 8;
+        unsigned char* message = malloc(max_chars + 1);
+        if (message == NULL) {
+            unmap_ppm(&m);
+            snprintf(line, sizeof(line), "{\"file\":%s,\"status\":\"error\",\"error\":\"%s\"}",
+                name, payload_messages[PAYLOAD_NOMEM]);
+            batch_emit(line);
+            __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        size_t length = lsb_extract(m.channels, message, max_chars);
+        free(message);
+        scanned = 8 * (length < max_chars ? length + 1 : length);
+        n = snprintf(line, sizeof(line),
+            "{\"file\":%s,\"status\":\"ok\",\"width\":%d,\"height\":%d,\"payload\":false,"
+            "\"text_length\":%zu,\"terminated\":%s", name, m.hdr.width, m.hdr.height,
+            length, length < max_chars ? "true" : "false");
+    } else {
+        scanned = 8 * STEGO_HEADER_BYTES;
+        if (result != PAYLOAD_TOO_LONG) {
+            scanned = stego_trailer_channel(hdr.length, hdr.bits) + lsb_channels(STEGO_TRAILER_BYTES, hdr.bits);
+        }
+        n = snprintf(line, sizeof(line),
+            "{\"file\":%s,\"status\":\"%s\",\"width\":%d,\"height\":%d,\"payload\":true,"
+            "\"bits\":%d,\"length\":%llu", name, result == PAYLOAD_OK ? "ok" : "error",
+            m.hdr.width, m.hdr.height, hdr.bits, (unsigned long long)hdr.length);
+        if (result == PAYLOAD_OK || result == PAYLOAD_CRC) {
+            n += snprintf(line + n, sizeof(line) - n, ",\"crc\":\"%s\"",
+                result == PAYLOAD_OK ? "ok" : "mismatch");
+        }
+        if (result != PAYLOAD_OK) {
+            n += snprintf(line + n, sizeof(line) - n, ",\"error\":\"%s\"", payload_messages[result]);
+        } else if (out != NULL) {
+            char out_name[1024];
+            batch_json_string(out_name, sizeof(out_name), out);
+            n += snprintf(line + n, sizeof(line) - n, ",\"output\":%s", out_name);
+        }
+    }
+    unmap_ppm(&m);
+
+    double seconds = batch_now() - start;
+    snprintf(line + n, sizeof(line) - n, ",\"bytes_scanned\":%zu,\"seconds\":%.6f,\"mb_per_s\":%.1f}",
+        scanned, seconds, seconds > 0 ? scanned / seconds / 1e6 : 0.0);
+    batch_emit(line);
+
+    int failed = result != PAYLOAD_OK && result != PAYLOAD_NO_HEADER;
+    __atomic_fetch_add(failed ? &batch->errors : &batch->ok, 1, __ATOMIC_RELAXED);
+    if (result != PAYLOAD_NO_HEADER) {
+        __atomic_fetch_add(&batch->payloads, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&batch->scanned, scanned, __ATOMIC_RELAXED);
+}
+
+// decode every file in files with numThreads workers
+// returns 0 if all of them were read and any payloads were intact, 1 otherwise
+static int run_batch(char** files, int count, const char* out_dir, int numThreads) {
+    struct batch_decode batch = {files, out_dir, 0, 0, 0, 0};
+    double start = batch_now();
+    batch_run(count, numThreads, batch_decode_file, &batch);
+    double seconds = batch_now() - start;
+
+    char line[512];
+    snprintf(line, sizeof(line),
+        "{\"summary\":true,\"files\":%d,\"ok\":%d,\"errors\":%d,\"payloads\":%d,"
+        "\"bytes_scanned\":%llu,\"seconds\":%.6f,\"files_per_s\":%.1f,\"mb_per_s\":%.1f}",
+        count, batch.ok, batch.errors, batch.payloads, batch.scanned, seconds,
+        seconds > 0 ? count / seconds : 0.0, seconds > 0 ? batch.scanned / seconds / 1e6 : 0.0);
+    batch_emit(line);
+    return batch.errors > 0;
+}
+
+static void usage(void) {
+    printf("usage: decode [-o payload [-j threads]] <file.ppm>\n");
+    printf("       decode -B [-o dir] [-j threads] <file.ppm>...\n");
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("usage: decode <file.ppm>\n");
+    const char* out_path = NULL;
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int batch = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:j:B")) != -1) {
+        switch (opt) {
+            case 'o': out_path = optarg; break;
+            case 'j': numThreads = atoi(optarg); break;
+            case 'B': batch = 1; break;
+            case '?': usage(); return 0;
+        }
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (batch) {
+        if (optind >= argc) {
+            usage();
+            return 0;
+        }
+        return run_batch(argv + optind, argc - optind, out_path, numThreads);
+    }
+    if (optind != argc - 1) {
+        usage();
         return 0;
     }
+    const char* filename = argv[optind];
 
-    int width, height;
-    struct ppm_pixel* pixels = read_ppm(argv[1], &width, &height);
-    if (pixels == NULL) {
+    struct mapped_ppm m;
+    int status = map_ppm(filename, &m);
+    if (status != PPM_OK) {
+        fprintf(stderr, "Error: %s: %s.\n", filename, ppm_strerror(status));
         printf("Error reading PPM file.\n");
         return 1;
     }
 
-    printf("Reading %s with width %d and height %d\n", argv[1], width, height);
+    printf("Reading %s with width %d and height %d\n", filename, m.hdr.width, m.hdr.height);
 
-    // Calculate the maximum number of characters that can be stored
-    int max_chars = (width * height * 3) / 8; // 3 colors per pixel, 8 bits per character
-    printf("Max number of characters in the image: %d\n", max_chars);
-
-    // Extract the message from the LSBs
-    unsigned char current_char = 0;
-    int bit_count = 0;
-    
-    for (int i = 0; i < width * height; i++) {
-        // Extract LSBs from red, green, and blue
-        unsigned char bits[3];
-        bits[0] = pixels[i].red & 1;    // LSB of red
-        bits[1] = pixels[i].green & 1;  // LSB of green
-        bits[2] = pixels[i].blue & 1;   // LSB of blue
-
-        // Append bits to current_char
-        for (int k = 0; k < 3; k++) {
-            current_char = (current_char << 1) | bits[k];
-            bit_count++;
-
-            // If we've read 8 bits, we have a full character
-            if (bit_count == 8) {
-                if (current_char == '\0') {
-                    printf("\n"); // End of message
-                    free_ppm(pixels); // Free memory
-                    return 0;
-                }
-                printf("%c", current_char);
-                current_char = 0;
-                bit_count = 0;
-            }
+    if (out_path != NULL) {
+        struct stego_pool* pool = stego_pool_create(numThreads);
+        if (pool == NULL) {
+            printf("Error: %s.\n", payload_messages[PAYLOAD_NOMEM]);
+            unmap_ppm(&m);
+            return 1;
+        }
+        struct stego_header hdr;
+        int result = extract_payload(m.channels, m.channel_count, out_path, pool, &hdr);
+        stego_pool_destroy(pool);
+        unmap_ppm(&m);
+        if (result != PAYLOAD_OK) {
+            printf("Error: %s.\n", payload_messages[result]);
+            return 1;
         }
+        printf("Payload of %llu bytes (%d bits per channel) written to %s\n",
+            (unsigned long long)hdr.length, hdr.bits, out_path);
+        return 0;
+    }
+
+    // Calculate the maximum number of characters that can be stored
+    size_t max_chars = m.channel_count / 8; // 3 colors per pixel, 8 bits per character
+    printf("Max number of characters in the image: %zu\n", max_chars);
+
+    // Only the pages of this buffer that the message reaches get touched
+    unsigned char* message = malloc(max_chars + 1);
+    if (message == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        unmap_ppm(&m);
+        return 1;
     }
 
-    printf("\n");
-    free_ppm(pixels); // Free memory
+    size_t length = lsb_extract(m.channels, message, max_chars);
+    message[length] = '\n';
+    fwrite(message, 1, length + 1, stdout);
+
+    free(message);
+    unmap_ppm(&m);
     return 0;
 }
-
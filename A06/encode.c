@@ -1,88 +1,314 @@
 /*----------------------------------------------
  * Author: Rami Nasr
  * Date: 10/11/2024
- * Description: This program embeds a user-provided message into the least significant bits (LSBs) of the red, green, and blue channels of each pixel in a PPM image. 
- * It reads the image using read_ppm, modifies the pixel data to hide the message, and then saves the modified image to a new file. 
+ * Description: This program embeds a user-provided message into the least significant bits (LSBs) of the red, green, and blue channels of each pixel in a PPM image.
+ * It reads the image using read_ppm, modifies the pixel data to hide the message, and then saves the modified image to a new file.
+ * The bits are merged 16 channels at a time by lsb_embed (see lsb.c).
+ * With -f, the contents of a file are embedded instead of a typed phrase: the payload is preceded
+ * by a length header and followed by a CRC-32 (see stego.h), and is read from disk in chunks so
+ * it is never held in memory as a whole. -b stores 1 to 4 payload bits in each channel for more
+ * capacity, and -j sets how many threads the embedding is split across.
+ * With -B, the payload is embedded into every image named on the command line by a pool of -j
+ * workers (one image per worker at a time) and a JSON line is printed per image.
  ---------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "read_ppm.h"
 #include "write_ppm.h"
+#include "lsb.h"
+#include "stego.h"
+#include "batch.h"
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("usage: encode <file.ppm>\n");
-        return 0;
+// a multiple of 3 so every chunk ends on a channel group (see lsb.h)
+#define CHUNK_SIZE (3 * 1024 * 1024)
+
+// status codes for embed_payload
+enum payload_status {
+    PAYLOAD_OK = 0,
+    PAYLOAD_OPEN,
+    PAYLOAD_TOO_LARGE,
+    PAYLOAD_NOMEM,
+    PAYLOAD_CHANGED
+};
+
+static const char* payload_messages[] = {
+    "OK",
+    "Cannot open payload file",
+    "The payload is too large to encode in this image",
+    "Memory allocation failed",
+    "Payload file changed while reading"
+};
+
+// embed the file at payload_path after a stego header, using bits per channel
+// pool: workers to split the embedding across, or NULL to do it on this thread
+// hdr: receives the header that was written
+// capacity: receives the number of payload bytes the image can hold
+// returns a payload_status code
+static int embed_payload(unsigned char* channels, size_t channel_count, const char* payload_path,
+                         int bits, struct stego_pool* pool, struct stego_header* hdr,
+                         uint64_t* capacity) {
+    *capacity = stego_capacity(channel_count, bits);
+    FILE* infile = fopen(payload_path, "rb");
+    struct stat st;
+    if (infile == NULL || fstat(fileno(infile), &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (infile) fclose(infile);
+        return PAYLOAD_OPEN;
+    }
+    hdr->bits = bits;
+    hdr->length = st.st_size;
+    if (hdr->length > *capacity) {
+        fclose(infile);
+        return PAYLOAD_TOO_LARGE;
     }
 
-    int width, height;
-    struct ppm_pixel* pixels = read_ppm(argv[1], &width, &height);
-    if (pixels == NULL) {
-        printf("Error reading PPM file.\n");
-        return 1;
+    // While the pool embeds one chunk, this thread checksums it and reads the next.
+    // Without a pool the embedding is done in place, so one buffer is enough.
+    unsigned char* chunk[2];
+    chunk[0] = malloc(CHUNK_SIZE);
+    chunk[1] = pool ? malloc(CHUNK_SIZE) : chunk[0];
+    if (chunk[0] == NULL || chunk[1] == NULL) {
+        free(chunk[0]);
+        if (pool) free(chunk[1]);
+        fclose(infile);
+        return PAYLOAD_NOMEM;
+    }
+    stego_write_header(channels, hdr);
+
+    uint32_t crc = 0;
+    uint64_t offset = 0;
+    int cur = 0;
+    size_t got = fread(chunk[cur], 1, hdr->length < CHUNK_SIZE ? hdr->length : CHUNK_SIZE, infile);
+    int failed = 0;
+    while (offset < hdr->length) {
+        if (got == 0) {
+            failed = 1;
+            break;
+        }
+        unsigned char* pos = channels + stego_channel(offset, bits);
+        if (pool) {
+            stego_pool_embed(pool, pos, chunk[cur], got, bits);
+        } else {
+            lsb_embed_bits(pos, chunk[cur], got, bits);
+        }
+        crc = stego_crc32(crc, chunk[cur], got);
+        offset += got;
+        uint64_t remaining = hdr->length - offset;
+        size_t next = 0;
+        if (pool) {
+            // the pool is still reading chunk[cur], so fill the other one
+            if (remaining > 0) {
+                next = fread(chunk[!cur], 1, remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE, infile);
+            }
+            stego_pool_wait(pool);
+            cur = !cur;
+        } else if (remaining > 0) {
+            next = fread(chunk[cur], 1, remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE, infile);
+        }
+        got = next;
+    }
+    free(chunk[0]);
+    if (pool) free(chunk[1]);
+    fclose(infile);
+    if (failed) {
+        return PAYLOAD_CHANGED;
+    }
+
+    unsigned char trailer[STEGO_TRAILER_BYTES] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    lsb_embed_bits(channels + stego_trailer_channel(hdr->length, bits), trailer, sizeof(trailer), bits);
+    return PAYLOAD_OK;
+}
+
+// store the name of the encoded copy of filename in out
+// e.g. "images/cat.ppm" becomes "images/cat-encoded.ppm"
+static void encoded_filename(const char* filename, char* out, size_t n) {
+    const char* dot_position = strrchr(filename, '.');
+    const char* slash_position = strrchr(filename, '/');
+    if (dot_position != NULL && (slash_position == NULL || dot_position > slash_position)) {
+        int basename_length = dot_position - filename;
+        snprintf(out, n, "%.*s-encoded%s", basename_length, filename, dot_position);
+    } else {
+        snprintf(out, n, "%s-encoded.ppm", filename);
     }
+}
 
-    printf("Reading %s with width %d and height %d\n", argv[1], width, height);
+// settings and totals shared by the batch workers
+struct batch_encode {
+    char** files;
+    const char* payload_path;
+    int bits;
+    int ok;
+    int errors;
+    unsigned long long bytes;
+};
 
-    int max_chars = (width * height * 3) / 8;
-    printf("Max number of characters that can be stored: %d\n", max_chars);
+// embed the payload into one image of a batch and print its JSON line
+static void batch_encode_file(int index, void* arg) {
+    struct batch_encode* batch = arg;
+    const char* filename = batch->files[index];
+    char name[1024];
+    char line[2560];
+    batch_json_string(name, sizeof(name), filename);
+    double start = batch_now();
 
-    char message[256];
-    printf("Enter a phrase to encode (max %d characters): ", max_chars);
-    fgets(message, sizeof(message), stdin);
-    int message_length = strlen(message);
+    int width, height, status;
+    struct ppm_pixel* pixels = read_ppm_status(filename, &width, &height, &status);
+    if (pixels == NULL) {
+        snprintf(line, sizeof(line), "{\"file\":%s,\"status\":\"error\",\"error\":\"%s\"}",
+            name, ppm_strerror(status));
+        batch_emit(line);
+        __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
 
-    if (message_length > max_chars) {
-        printf("Error: The message is too long to encode in this image.\n");
+    size_t bytes = (size_t)width * height * sizeof(struct ppm_pixel);
+    struct stego_header hdr;
+    uint64_t capacity;
+    int result = embed_payload((unsigned char*)pixels, bytes, batch->payload_path, batch->bits,
+                               NULL, &hdr, &capacity);
+    if (result != PAYLOAD_OK) {
         free_ppm(pixels);
-        return 1;
+        snprintf(line, sizeof(line),
+            "{\"file\":%s,\"status\":\"error\",\"width\":%d,\"height\":%d,\"capacity\":%llu,\"error\":\"%s\"}",
+            name, width, height, (unsigned long long)capacity, payload_messages[result]);
+        batch_emit(line);
+        __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+        return;
     }
 
-    int char_index = 0;
-    int bit_index = 0;
-    for (int i = 0; i < width * height; i++) {
-        if (char_index >= message_length) break;
+    char output_filename[1024];
+    char output_name[1024];
+    encoded_filename(filename, output_filename, sizeof(output_filename));
+    int written = write_ppm_status(output_filename, pixels, width, height);
+    free_ppm(pixels);
+    batch_json_string(output_name, sizeof(output_name), output_filename);
+    if (written != 0) {
+        snprintf(line, sizeof(line),
+            "{\"file\":%s,\"status\":\"error\",\"output\":%s,\"error\":\"Cannot write output file\"}",
+            name, output_name);
+        batch_emit(line);
+        __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
 
-        pixels[i].red &= 0xFE;
-        pixels[i].green &= 0xFE;
-        pixels[i].blue &= 0xFE;
+    double seconds = batch_now() - start;
+    snprintf(line, sizeof(line),
+        "{\"file\":%s,\"status\":\"ok\",\"output\":%s,\"width\":%d,\"height\":%d,\"bits\":%d,"
+        "\"length\":%llu,\"capacity\":%llu,\"bytes\":%zu,\"seconds\":%.6f,\"mb_per_s\":%.1f}",
+        name, output_name, width, height, hdr.bits, (unsigned long long)hdr.length,
+        (unsigned long long)capacity, bytes, seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    batch_emit(line);
+    __atomic_fetch_add(&batch->ok, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&batch->bytes, bytes, __ATOMIC_RELAXED);
+}
 
-        pixels[i].red |= (message[char_index] >> (7 - bit_index)) & 1;
-        if (++bit_index == 8) {
-            bit_index = 0;
-            char_index++;
-            if (char_index >= message_length) break;
-        }
+// embed payload_path into every file in files with numThreads workers
+// returns 0 if every image was encoded, 1 otherwise
+static int run_batch(char** files, int count, const char* payload_path, int bits, int numThreads) {
+    struct batch_encode batch = {files, payload_path, bits, 0, 0, 0};
+    double start = batch_now();
+    batch_run(count, numThreads, batch_encode_file, &batch);
+    double seconds = batch_now() - start;
 
-        pixels[i].green |= (message[char_index] >> (7 - bit_index)) & 1;
-        if (++bit_index == 8) {
-            bit_index = 0;
-            char_index++;
-            if (char_index >= message_length) break;
-        }
+    char line[512];
+    snprintf(line, sizeof(line),
+        "{\"summary\":true,\"files\":%d,\"ok\":%d,\"errors\":%d,\"bytes\":%llu,"
+        "\"seconds\":%.6f,\"files_per_s\":%.1f,\"mb_per_s\":%.1f}",
+        count, batch.ok, batch.errors, batch.bytes, seconds,
+        seconds > 0 ? count / seconds : 0.0, seconds > 0 ? batch.bytes / seconds / 1e6 : 0.0);
+    batch_emit(line);
+    return batch.errors > 0;
+}
 
-        pixels[i].blue |= (message[char_index] >> (7 - bit_index)) & 1;
-        if (++bit_index == 8) {
-            bit_index = 0;
-            char_index++;
+static void usage(void) {
+    printf("usage: encode [-f payload [-b bits] [-j threads]] <file.ppm>\n");
+    printf("       encode -B -f payload [-b bits] [-j threads] <file.ppm>...\n");
+}
+
+int main(int argc, char** argv) {
+    const char* payload_path = NULL;
+    int bits = 1;
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int batch = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:j:B")) != -1) {
+        switch (opt) {
+            case 'f': payload_path = optarg; break;
+            case 'b': bits = atoi(optarg); break;
+            case 'j': numThreads = atoi(optarg); break;
+            case 'B': batch = 1; break;
+            case '?': usage(); return 0;
         }
     }
+    if (batch ? (optind >= argc || payload_path == NULL) : optind != argc - 1) {
+        usage();
+        return 0;
+    }
+    if (bits < 1 || bits > STEGO_MAX_BITS) {
+        printf("Error: Bits per channel must be between 1 and %d.\n", STEGO_MAX_BITS);
+        return 1;
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (batch) {
+        return run_batch(argv + optind, argc - optind, payload_path, bits, numThreads);
+    }
+    const char* filename = argv[optind];
 
-    char output_filename[256];
-    char* dot_position = strrchr(argv[1], '.');
-    if (dot_position != NULL) {
-        size_t basename_length = dot_position - argv[1];
-        snprintf(output_filename, basename_length + 9, "%.*s-encoded", (int)basename_length, argv[1]);
-        strcat(output_filename, dot_position);
+    int width, height;
+    struct ppm_pixel* pixels = read_ppm(filename, &width, &height);
+    if (pixels == NULL) {
+        printf("Error reading PPM file.\n");
+        return 1;
+    }
+
+    printf("Reading %s with width %d and height %d\n", filename, width, height);
+
+    if (payload_path != NULL) {
+        struct stego_pool* pool = stego_pool_create(numThreads);
+        struct stego_header hdr;
+        uint64_t capacity = 0;
+        int result = PAYLOAD_NOMEM;
+        if (pool != NULL) {
+            result = embed_payload((unsigned char*)pixels, (size_t)width * height * 3, payload_path,
+                                   bits, pool, &hdr, &capacity);
+            stego_pool_destroy(pool);
+        }
+        if (result == PAYLOAD_OK || result == PAYLOAD_TOO_LARGE) {
+            printf("Payload %s is %llu bytes (max %llu bytes at %d bits per channel)\n", payload_path,
+                (unsigned long long)hdr.length, (unsigned long long)capacity, bits);
+        }
+        if (result != PAYLOAD_OK) {
+            printf("Error: %s.\n", payload_messages[result]);
+            free_ppm(pixels);
+            return 1;
+        }
     } else {
-        snprintf(output_filename, sizeof(output_filename), "%s-encoded.ppm", argv[1]);
+        int max_chars = (width * height * 3) / 8;
+        printf("Max number of characters that can be stored: %d\n", max_chars);
+
+        char message[256];
+        printf("Enter a phrase to encode (max %d characters): ", max_chars);
+        fgets(message, sizeof(message), stdin);
+        int message_length = strlen(message);
+
+        if (message_length + 1 > max_chars) {
+            printf("Error: The message is too long to encode in this image.\n");
+            free_ppm(pixels);
+            return 1;
+        }
+
+        // The terminating '\0' is embedded too so decode knows where to stop
+        lsb_embed((unsigned char*)pixels, (const unsigned char*)message, message_length + 1);
     }
 
+    char output_filename[1024];
+    encoded_filename(filename, output_filename, sizeof(output_filename));
+
     write_ppm(output_filename, pixels, width, height);
-    printf("Message encoded and written to %s\n", output_filename);
+    printf("%s encoded and written to %s\n", payload_path ? "Payload" : "Message", output_filename);
 
     free_ppm(pixels);
     return 0;
 }
-
@@ -0,0 +1,233 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: Word-at-a-time least significant bit embedding. Each message byte is expanded
+ * through a lookup table into a 64-bit word with one message bit in the low bit of each byte,
+ * which is merged into 8 channel bytes with a single mask and OR (16 channels per step with SSE2).
+ * Extraction goes the other way: the low bits of 8 channel bytes are gathered with one multiply,
+ * or with SSE2 movemask 64 channels (8 message bytes) per step.
+ * With 2 or 4 bits per channel each message byte still maps to whole channels, so the same
+ * table trick is used on 4 or 2 channel words; 3 bits per channel packs 3 message bytes into
+ * 8 channels and goes through a bit accumulator.
+ ---------------------------------------------*/
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "lsb.h"
+
+#define LSB_CLEAR 0xFEFEFEFEFEFEFEFEull
+#define LSB_ONES 0x0101010101010101ull
+#define LSB_HIGHS 0x8080808080808080ull
+// multiplying the isolated low bits by this moves bit 8*k to bit 63-k
+#define LSB_GATHER 0x8040201008040201ull
+
+// spread[m] holds bit 7 of m in byte 0, bit 6 in byte 1, ... (little-endian)
+static uint64_t spread[256];
+// reverse[m] is m with its bit order reversed
+static unsigned char reverse[256];
+// spread2[m] holds the 2 bit fields of m (most significant first) in bytes 0..3,
+// spread4[m] holds the 4 bit fields in bytes 0..1
+static uint32_t spread2[256];
+static uint16_t spread4[256];
+
+static void lsb_init() __attribute__((constructor));
+
+void lsb_init() {
+    for (int m = 0; m < 256; m++) {
+        uint64_t word = 0;
+        for (int k = 0; k < 8; k++) {
+            word |= (uint64_t)((m >> (7 - k)) & 1) << (8 * k);
+        }
+        spread[m] = word;
+
+        unsigned char r = 0;
+        for (int k = 0; k < 8; k++) {
+            r |= ((m >> k) & 1) << (7 - k);
+        }
+        reverse[m] = r;
+
+        uint32_t word2 = 0;
+        for (int k = 0; k < 4; k++) {
+            word2 |= (uint32_t)((m >> (6 - 2 * k)) & 3) << (8 * k);
+        }
+        spread2[m] = word2;
+        spread4[m] = (m >> 4) | ((m & 15) << 8);
+    }
+}
+
+static inline uint64_t to_little_endian(uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+static inline uint32_t to_little_endian32(uint32_t word) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(word);
+#else
+    return word;
+#endif
+}
+
+static inline uint16_t to_little_endian16(uint16_t word) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap16(word);
+#else
+    return word;
+#endif
+}
+
+size_t lsb_group_bytes(int bits) {
+    return bits == 3 ? 3 : 1;
+}
+
+size_t lsb_channels(size_t len, int bits) {
+    return (8 * len + bits - 1) / bits;
+}
+
+void lsb_embed(unsigned char* channels, const unsigned char* msg, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i clear = _mm_set1_epi8((char)0xFE);
+    for (; i + 2 <= len; i += 2) {
+        __m128i* p = (__m128i*)(channels + 8 * i);
+        __m128i bits = _mm_set_epi64x(spread[msg[i + 1]], spread[msg[i]]);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(p), clear), bits));
+    }
+#endif
+    for (; i < len; i++) {
+        uint64_t word;
+        memcpy(&word, channels + 8 * i, 8);
+        word = (word & LSB_CLEAR) | to_little_endian(spread[msg[i]]);
+        memcpy(channels + 8 * i, &word, 8);
+    }
+}
+
+static inline unsigned char gather_byte(const unsigned char* channels) {
+    uint64_t word;
+    memcpy(&word, channels, 8);
+    word = to_little_endian(word);
+    return ((word & LSB_ONES) * LSB_GATHER) >> 56;
+}
+
+#ifdef __SSE2__
+// fill out[0..8) from the LSBs of channels[0..64)
+static inline void gather_group(const unsigned char* channels, unsigned char* out) {
+    // movemask collects bit 7 of each byte, so shift the LSBs up first;
+    // the result lists channel 0 in bit 0, i.e. each byte comes out reversed
+    uint64_t group = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(channels + 16 * k));
+        uint64_t mask = (unsigned int)_mm_movemask_epi8(_mm_slli_epi64(v, 7));
+        group |= mask << (16 * k);
+    }
+    for (int k = 0; k < 8; k++) {
+        out[k] = reverse[(group >> (8 * k)) & 0xff];
+    }
+}
+#endif
+
+size_t lsb_extract(const unsigned char* channels, unsigned char* out, size_t max_len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= max_len; i += 8) {
+        gather_group(channels + 8 * i, out + i);
+        uint64_t word;
+        memcpy(&word, out + i, 8);
+        if ((word - LSB_ONES) & ~word & LSB_HIGHS) {
+            break;  // a terminator is somewhere in these 8 bytes
+        }
+    }
+#endif
+    for (; i < max_len; i++) {
+        out[i] = gather_byte(channels + 8 * i);
+        if (out[i] == '\0') {
+            return i;
+        }
+    }
+    return max_len;
+}
+
+void lsb_read(const unsigned char* channels, unsigned char* out, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= len; i += 8) {
+        gather_group(channels + 8 * i, out + i);
+    }
+#endif
+    for (; i < len; i++) {
+        out[i] = gather_byte(channels + 8 * i);
+    }
+}
+
+void lsb_embed_bits(unsigned char* channels, const unsigned char* msg, size_t len, int bits) {
+    if (bits == 1) {
+        lsb_embed(channels, msg, len);
+    } else if (bits == 2) {
+        for (size_t i = 0; i < len; i++) {
+            uint32_t word;
+            memcpy(&word, channels + 4 * i, 4);
+            word = (word & 0xFCFCFCFCu) | to_little_endian32(spread2[msg[i]]);
+            memcpy(channels + 4 * i, &word, 4);
+        }
+    } else if (bits == 4) {
+        for (size_t i = 0; i < len; i++) {
+            uint16_t word;
+            memcpy(&word, channels + 2 * i, 2);
+            word = (word & 0xF0F0u) | to_little_endian16(spread4[msg[i]]);
+            memcpy(channels + 2 * i, &word, 2);
+        }
+    } else {
+        // fields are taken from the top of acc; only its low 'have' bits are pending
+        unsigned int mask = (1u << bits) - 1;
+        uint32_t acc = 0;
+        int have = 0;
+        size_t i = 0;
+        for (;;) {
+            if (have < bits) {
+                if (i == len) break;
+                acc = (acc << 8) | msg[i++];
+                have += 8;
+            } else {
+                have -= bits;
+                *channels = (*channels & ~mask) | ((acc >> have) & mask);
+                channels++;
+            }
+        }
+        if (have > 0) {
+            // last field is only partly used; pad it with zeros
+            *channels = (*channels & ~mask) | ((acc << (bits - have)) & mask);
+        }
+    }
+}
+
+void lsb_read_bits(const unsigned char* channels, unsigned char* out, size_t len, int bits) {
+    if (bits == 1) {
+        lsb_read(channels, out, len);
+    } else if (bits == 2) {
+        for (size_t i = 0; i < len; i++) {
+            const unsigned char* c = channels + 4 * i;
+            out[i] = ((c[0] & 3) << 6) | ((c[1] & 3) << 4) | ((c[2] & 3) << 2) | (c[3] & 3);
+        }
+    } else if (bits == 4) {
+        for (size_t i = 0; i < len; i++) {
+            out[i] = ((channels[2 * i] & 15) << 4) | (channels[2 * i + 1] & 15);
+        }
+    } else {
+        unsigned int mask = (1u << bits) - 1;
+        uint32_t acc = 0;
+        int have = 0;
+        for (size_t i = 0; i < len; i++) {
+            while (have < 8) {
+                acc = (acc << bits) | (*channels++ & mask);
+                have += bits;
+            }
+            have -= 8;
+            out[i] = acc >> have;
+        }
+    }
+}
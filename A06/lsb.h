@@ -0,0 +1,39 @@
+#ifndef LSB_H_
+#define LSB_H_
+
+#include <stddef.h>
+
+// Message bits are stored one per channel byte (red, green, blue, red, ...),
+// most significant bit of each message byte first, so message byte i lives
+// in the least significant bits of channel bytes 8*i .. 8*i+7.
+
+// hide len bytes of msg in the LSBs of channels[0 .. 8*len)
+extern void lsb_embed(unsigned char* channels, const unsigned char* msg, size_t len);
+
+// recover a '\0' terminated message from the LSBs of channels
+// out: receives up to max_len bytes (the terminator is not stored)
+// max_len: number of message bytes available, i.e. channel bytes / 8
+// returns the message length, or max_len if no terminator was found
+extern size_t lsb_extract(const unsigned char* channels, unsigned char* out, size_t max_len);
+
+// recover exactly len bytes from the LSBs of channels[0 .. 8*len), '\0' included
+extern void lsb_read(const unsigned char* channels, unsigned char* out, size_t len);
+
+// With bits > 1 the message is treated as a bit stream (most significant bit
+// first) cut into fields of that many bits, one field per channel byte. Message
+// bytes then map to channels in groups of lsb_group_bytes(bits) bytes.
+
+// number of message bytes in the smallest run that fills whole channels
+// (1 for 1, 2 and 4 bits per channel, 3 for 3 bits per channel)
+extern size_t lsb_group_bytes(int bits);
+
+// number of channel bytes used by len message bytes at bits per channel
+extern size_t lsb_channels(size_t len, int bits);
+
+// hide len bytes of msg using the low bits (1-4) of each channel
+extern void lsb_embed_bits(unsigned char* channels, const unsigned char* msg, size_t len, int bits);
+
+// recover len bytes hidden by lsb_embed_bits
+extern void lsb_read_bits(const unsigned char* channels, unsigned char* out, size_t len, int bits);
+
+#endif
@@ -0,0 +1,181 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: Conversion between packed RGB pixels and separate R/G/B planes.
+ * On x86 processors with SSSE3 (checked at run time) 16 pixels are split or merged per step
+ * with byte shuffles; other machines use the scalar loops.
+ ---------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "planar.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLANAR_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+struct ppm_planar* planar_alloc(int w, int h) {
+    struct ppm_planar* img = malloc(sizeof(struct ppm_planar));
+    if (img == NULL) {
+        return NULL;
+    }
+    img->width = w;
+    img->height = h;
+    img->stride = ((size_t)w + PLANAR_ALIGN - 1) & ~(size_t)(PLANAR_ALIGN - 1);
+
+    size_t plane_size = img->stride * h;
+    if (posix_memalign((void**)&img->data, PLANAR_ALIGN, plane_size * 3) != 0) {
+        free(img);
+        return NULL;
+    }
+    for (int c = 0; c < 3; c++) {
+        img->plane[c] = img->data + plane_size * c;
+    }
+    return img;
+}
+
+void planar_free(struct ppm_planar* img) {
+    if (img != NULL) {
+        free(img->data);
+        free(img);
+    }
+}
+
+static void split_scalar(const unsigned char* src, unsigned char* r, unsigned char* g,
+                         unsigned char* b, int n) {
+    for (int i = 0; i < n; i++) {
+        r[i] = src[3 * i];
+        g[i] = src[3 * i + 1];
+        b[i] = src[3 * i + 2];
+    }
+}
+
+static void merge_scalar(const unsigned char* r, const unsigned char* g, const unsigned char* b,
+                         unsigned char* dst, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[3 * i] = r[i];
+        dst[3 * i + 1] = g[i];
+        dst[3 * i + 2] = b[i];
+    }
+}
+
+#ifdef PLANAR_SSSE3
+// split_mask[c][k] gathers channel c from the k-th 16 byte block of 16
+// packed pixels; merge_mask[k][c] places channel c into output block k.
+// Lanes holding 0x80 are zeroed by pshufb.
+static unsigned char split_mask[3][3][16] __attribute__((aligned(16)));
+static unsigned char merge_mask[3][3][16] __attribute__((aligned(16)));
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static int simd_state;
+
+static void init_masks(void) {
+    memset(split_mask, 0x80, sizeof(split_mask));
+    memset(merge_mask, 0x80, sizeof(merge_mask));
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 16; i++) {
+            int src = 3 * i + c;
+            split_mask[c][src / 16][i] = src % 16;
+        }
+    }
+    for (int g = 0; g < 48; g++) {
+        merge_mask[g / 16][g % 3][g % 16] = g / 3;
+    }
+}
+
+__attribute__((target("ssse3")))
+static int split_ssse3(const unsigned char* src, unsigned char* r, unsigned char* g,
+                       unsigned char* b, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i in[3];
+        for (int k = 0; k < 3; k++) {
+            in[k] = _mm_loadu_si128((const __m128i*)(src + 3 * i + 16 * k));
+        }
+        unsigned char* out[3] = {r, g, b};
+        for (int c = 0; c < 3; c++) {
+            __m128i v = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(in[0], _mm_load_si128((const __m128i*)split_mask[c][0])),
+                             _mm_shuffle_epi8(in[1], _mm_load_si128((const __m128i*)split_mask[c][1]))),
+                _mm_shuffle_epi8(in[2], _mm_load_si128((const __m128i*)split_mask[c][2])));
+            _mm_storeu_si128((__m128i*)(out[c] + i), v);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static int merge_ssse3(const unsigned char* r, const unsigned char* g, const unsigned char* b,
+                       unsigned char* dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i in[3] = {
+            _mm_loadu_si128((const __m128i*)(r + i)),
+            _mm_loadu_si128((const __m128i*)(g + i)),
+            _mm_loadu_si128((const __m128i*)(b + i))};
+        for (int k = 0; k < 3; k++) {
+            __m128i v = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(in[0], _mm_load_si128((const __m128i*)merge_mask[k][0])),
+                             _mm_shuffle_epi8(in[1], _mm_load_si128((const __m128i*)merge_mask[k][1]))),
+                _mm_shuffle_epi8(in[2], _mm_load_si128((const __m128i*)merge_mask[k][2])));
+            _mm_storeu_si128((__m128i*)(dst + 3 * i + 16 * k), v);
+        }
+    }
+    return i;
+}
+
+static void detect_simd(void) {
+    __builtin_cpu_init();
+    simd_state = __builtin_cpu_supports("ssse3");
+    if (simd_state) init_masks();
+}
+
+static int simd_supported(void) {
+    pthread_once(&simd_once, detect_simd);
+    return simd_state;
+}
+#endif
+
+void planar_load_rows(struct ppm_planar* img, const struct ppm_pixel* pxs,
+                      int start_row, int end_row) {
+    int w = img->width;
+    for (int y = start_row; y < end_row; y++) {
+        const unsigned char* src = (const unsigned char*)(pxs + (size_t)y * w);
+        unsigned char* r = img->plane[0] + y * img->stride;
+        unsigned char* g = img->plane[1] + y * img->stride;
+        unsigned char* b = img->plane[2] + y * img->stride;
+        int done = 0;
+#ifdef PLANAR_SSSE3
+        if (simd_supported()) done = split_ssse3(src, r, g, b, w);
+#endif
+        split_scalar(src + 3 * done, r + done, g + done, b + done, w - done);
+    }
+}
+
+void planar_store_rows(const struct ppm_planar* img, struct ppm_pixel* pxs,
+                       int start_row, int end_row) {
+    int w = img->width;
+    for (int y = start_row; y < end_row; y++) {
+        unsigned char* dst = (unsigned char*)(pxs + (size_t)y * w);
+        const unsigned char* r = img->plane[0] + y * img->stride;
+        const unsigned char* g = img->plane[1] + y * img->stride;
+        const unsigned char* b = img->plane[2] + y * img->stride;
+        int done = 0;
+#ifdef PLANAR_SSSE3
+        if (simd_supported()) done = merge_ssse3(r, g, b, dst, w);
+#endif
+        merge_scalar(r + done, g + done, b + done, dst + 3 * done, w - done);
+    }
+}
+
+struct ppm_planar* planar_from_pixels(const struct ppm_pixel* pxs, int w, int h) {
+    struct ppm_planar* img = planar_alloc(w, h);
+    if (img != NULL) {
+        planar_load_rows(img, pxs, 0, h);
+    }
+    return img;
+}
+
+void planar_to_pixels(const struct ppm_planar* img, struct ppm_pixel* pxs) {
+    planar_store_rows(img, pxs, 0, img->height);
+}
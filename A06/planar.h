@@ -0,0 +1,43 @@
+#ifndef PLANAR_H_
+#define PLANAR_H_
+
+#include <stddef.h>
+#include "read_ppm.h"
+
+// rows of every plane start on this boundary (in bytes)
+#define PLANAR_ALIGN 64
+
+// An image stored as three separate channel planes instead of packed
+// ppm_pixel triples, so a kernel working on one channel reads contiguous
+// bytes and can use full-width vector loads.
+struct ppm_planar {
+  int width;
+  int height;
+  size_t stride;             // bytes from one row to the next in a plane
+  unsigned char* plane[3];   // red, green, blue
+  unsigned char* data;       // single allocation holding all three planes
+};
+
+// allocate an uninitialized planar image
+// returns NULL if the memory cannot be allocated
+extern struct ppm_planar* planar_alloc(int w, int h);
+
+// free a planar image from planar_alloc or planar_from_pixels
+extern void planar_free(struct ppm_planar* img);
+
+// split a 1D array of ppm_pixel into planes
+// returns NULL if the memory cannot be allocated
+extern struct ppm_planar* planar_from_pixels(const struct ppm_pixel* pxs, int w, int h);
+
+// split rows [start_row, end_row) of pxs into an existing planar image
+extern void planar_load_rows(struct ppm_planar* img, const struct ppm_pixel* pxs,
+    int start_row, int end_row);
+
+// interleave rows [start_row, end_row) of a planar image back into pxs
+extern void planar_store_rows(const struct ppm_planar* img, struct ppm_pixel* pxs,
+    int start_row, int end_row);
+
+// interleave a whole planar image into pxs (width*height pixels)
+extern void planar_to_pixels(const struct ppm_planar* img, struct ppm_pixel* pxs);
+
+#endif
@@ -1,12 +1,52 @@
 #ifndef PPM_READ_H_
 #define PPM_READ_H_
 
+#include <stddef.h>
+
 struct ppm_pixel {
   unsigned char red;
   unsigned char green;
   unsigned char blue;
 };
 
+// status codes returned by the PPM reader
+enum ppm_status {
+  PPM_OK = 0,
+  PPM_ERR_OPEN,        // the file could not be opened
+  PPM_ERR_MAGIC,       // the file does not start with P6
+  PPM_ERR_HEADER,      // a header field is malformed
+  PPM_ERR_TRUNCATED,   // the header or pixel data ends early
+  PPM_ERR_MAXVAL,      // max color value is outside 1..255
+  PPM_ERR_DIMENSIONS,  // width/height are zero or width*height overflows
+  PPM_ERR_NOMEM        // the pixel array could not be allocated
+};
+
+// fields of a parsed P6 header
+struct ppm_header {
+  int width;
+  int height;
+  int max_val;
+  size_t data_offset;  // byte offset of the first pixel in the file
+};
+
+// parse a P6 header held in memory
+// buf: the first len bytes of the file
+// hdr: filled in on success
+// returns PPM_OK, or PPM_ERR_TRUNCATED if buf ends before the header does
+extern int ppm_parse_header(const unsigned char* buf, size_t len, struct ppm_header* hdr);
+
+// read in a PPM file in binary format
+// filename: the image to load
+// w: pointer argument for returning the width of the image
+// h: pointer argument for returning the height of the image
+// status: pointer argument for returning a ppm_status code (may be NULL)
+// returns a 1D array of ppm_pixel, or NULL, if the file cannot be loaded
+// NOTE: Caller is responsible for freeing the returned array
+extern struct ppm_pixel* read_ppm_status(const char* filename, int* w, int* h, int* status);
+
+// returns a human readable message for a ppm_status code
+extern const char* ppm_strerror(int status);
+
 // read in a PPM file in binary format
 // filename: the image to load
 // w: pointer argument for returning the width of the image
@@ -23,5 +63,7 @@ extern struct ppm_pixel* read_ppm(const char* filename, int* w, int* h);
 // NOTE: Caller is responsible for freeing the returned array
 extern struct ppm_pixel** read_ppm_2d(const char* filename, int* w, int* h);
 
-#endif
+// frees an array returned by read_ppm
+extern void free_ppm(struct ppm_pixel* pixels);
 
+#endif
@@ -0,0 +1,380 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: Estimates how much of a PPM image carries an LSB payload, using two classic tests.
+ * The chi-square attack checks whether the counts of each value pair (2k, 2k+1) have been
+ * equalized, as embedding random bits does; it is run over growing prefixes of the image so the
+ * length of a sequentially embedded message shows up as the point where the p-value drops.
+ * RS analysis counts how flipping LSBs changes the smoothness of small pixel groups and solves
+ * for the fraction of channels that were already flipped by embedding.
+ * The image is cut into row segments that are analysed in parallel by -j workers (see batch.c);
+ * each segment builds its histogram and its RS counts in the same pass, with the RS groups
+ * (4 vertically adjacent values of one channel) evaluated 8 at a time with SSE2 where available.
+ ---------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "read_ppm.h"
+#include "batch.h"
+
+#define MAX_SEGMENTS 100
+
+// RS counters, per channel: groups made rougher (R) or smoother (S) by the
+// mask M = [0 1 1 0] and by -M, on the image and on the image with every LSB
+// flipped
+enum rs_stat {RM, SM, RNM, SNM, RM_FLIP, SM_FLIP, RNM_FLIP, SNM_FLIP, RS_STATS};
+
+struct analysis {
+    const unsigned char* data;
+    int width;
+    int height;
+    size_t row_bytes;
+    int quads;       // number of complete groups of 4 rows
+    int segments;
+    uint64_t (*hist)[256];           // histogram of every segment
+    uint64_t (*rs)[3][RS_STATS];     // RS counts of every segment
+};
+
+// rows [y0, y1) of segment s; segments start on a multiple of 4 rows and
+// the last one also takes the rows left over after the final quad
+static void segment_rows(const struct analysis* a, int s, int* y0, int* y1) {
+    *y0 = 4 * (int)((long long)a->quads * s / a->segments);
+    *y1 = s == a->segments - 1 ? a->height : 4 * (int)((long long)a->quads * (s + 1) / a->segments);
+}
+
+static inline int smoothness(int a, int b, int c, int d) {
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+// the "negative" flip: -1 <-> 0, 1 <-> 2, ..., 255 <-> 256
+static inline int flip_neg(int x) {
+    return ((x + 1) ^ 1) - 1;
+}
+
+static void rs_group(int x0, int x1, int x2, int x3, uint64_t* stats) {
+    int f = smoothness(x0, x1, x2, x3);
+    int fm = smoothness(x0, x1 ^ 1, x2 ^ 1, x3);
+    int fn = smoothness(x0, flip_neg(x1), flip_neg(x2), x3);
+    stats[RM] += fm > f;
+    stats[SM] += fm < f;
+    stats[RNM] += fn > f;
+    stats[SNM] += fn < f;
+
+    // the same group with every LSB flipped first
+    int y0 = x0 ^ 1, y1 = x1 ^ 1, y2 = x2 ^ 1, y3 = x3 ^ 1;
+    f = smoothness(y0, y1, y2, y3);
+    fm = smoothness(y0, x1, x2, y3);
+    fn = smoothness(y0, flip_neg(y1), flip_neg(y2), y3);
+    stats[RM_FLIP] += fm > f;
+    stats[SM_FLIP] += fm < f;
+    stats[RNM_FLIP] += fn > f;
+    stats[SNM_FLIP] += fn < f;
+}
+
+#ifdef __SSE2__
+static inline __m128i absdiff16(__m128i a, __m128i b) {
+    return _mm_max_epi16(_mm_sub_epi16(a, b), _mm_sub_epi16(b, a));
+}
+
+static inline __m128i smoothness16(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_add_epi16(_mm_add_epi16(absdiff16(a, b), absdiff16(b, c)), absdiff16(c, d));
+}
+
+static inline __m128i flip_neg16(__m128i x, __m128i one) {
+    return _mm_sub_epi16(_mm_xor_si128(_mm_add_epi16(x, one), one), one);
+}
+
+// count 8 groups starting at byte x of the four rows; acc lanes count hits
+static inline void rs_groups8(const unsigned char* const* rows, size_t x, __m128i* acc) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i v[4], w[4];
+    for (int k = 0; k < 4; k++) {
+        v[k] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(rows[k] + x)), zero);
+        w[k] = _mm_xor_si128(v[k], one);
+    }
+    __m128i f = smoothness16(v[0], v[1], v[2], v[3]);
+    __m128i fm = smoothness16(v[0], w[1], w[2], v[3]);
+    __m128i fn = smoothness16(v[0], flip_neg16(v[1], one), flip_neg16(v[2], one), v[3]);
+    // a true compare is -1, so subtracting it counts
+    acc[RM] = _mm_sub_epi16(acc[RM], _mm_cmpgt_epi16(fm, f));
+    acc[SM] = _mm_sub_epi16(acc[SM], _mm_cmpgt_epi16(f, fm));
+    acc[RNM] = _mm_sub_epi16(acc[RNM], _mm_cmpgt_epi16(fn, f));
+    acc[SNM] = _mm_sub_epi16(acc[SNM], _mm_cmpgt_epi16(f, fn));
+
+    f = smoothness16(w[0], w[1], w[2], w[3]);
+    fm = smoothness16(w[0], v[1], v[2], w[3]);
+    fn = smoothness16(w[0], flip_neg16(w[1], one), flip_neg16(w[2], one), w[3]);
+    acc[RM_FLIP] = _mm_sub_epi16(acc[RM_FLIP], _mm_cmpgt_epi16(fm, f));
+    acc[SM_FLIP] = _mm_sub_epi16(acc[SM_FLIP], _mm_cmpgt_epi16(f, fm));
+    acc[RNM_FLIP] = _mm_sub_epi16(acc[RNM_FLIP], _mm_cmpgt_epi16(fn, f));
+    acc[SNM_FLIP] = _mm_sub_epi16(acc[SNM_FLIP], _mm_cmpgt_epi16(f, fn));
+}
+
+// add the per-lane counts of acc[v] (lane k holds byte 8*v + k of each
+// 24 byte step, i.e. channel (8*v + k) % 3) to stats and clear them
+static void rs_flush(__m128i acc[3][RS_STATS], uint64_t stats[3][RS_STATS]) {
+    for (int v = 0; v < 3; v++) {
+        for (int s = 0; s < RS_STATS; s++) {
+            uint16_t lanes[8];
+            _mm_storeu_si128((__m128i*)lanes, acc[v][s]);
+            for (int k = 0; k < 8; k++) {
+                stats[(8 * v + k) % 3][s] += lanes[k];
+            }
+            acc[v][s] = _mm_setzero_si128();
+        }
+    }
+}
+#endif
+
+// RS counts for the quad of rows starting at y
+static void rs_quad(const struct analysis* a, int y, uint64_t stats[3][RS_STATS]) {
+    const unsigned char* rows[4];
+    for (int k = 0; k < 4; k++) {
+        rows[k] = a->data + (size_t)(y + k) * a->row_bytes;
+    }
+    size_t x = 0;
+#ifdef __SSE2__
+    // 24 bytes per step keeps the channel of every lane fixed
+    __m128i acc[3][RS_STATS];
+    memset(acc, 0, sizeof(acc));
+    int steps = 0;
+    for (; x + 24 <= a->row_bytes; x += 24) {
+        for (int v = 0; v < 3; v++) {
+            rs_groups8(rows, x + 8 * v, acc[v]);
+        }
+        if (++steps == 32767) {
+            rs_flush(acc, stats);
+            steps = 0;
+        }
+    }
+    rs_flush(acc, stats);
+#endif
+    for (; x < a->row_bytes; x++) {
+        rs_group(rows[0][x], rows[1][x], rows[2][x], rows[3][x], stats[x % 3]);
+    }
+}
+
+static void analyse_segment(int s, void* arg) {
+    struct analysis* a = arg;
+    int y0, y1;
+    segment_rows(a, s, &y0, &y1);
+
+    // four histograms so repeated values do not wait on each other's increments;
+    // flushed every block so the 32 bit counters cannot overflow
+    const size_t block = (size_t)1 << 30;
+    const unsigned char* p = a->data + (size_t)y0 * a->row_bytes;
+    size_t n = (size_t)(y1 - y0) * a->row_bytes;
+    for (size_t start = 0; start < n; start += block) {
+        uint32_t counts[4][256];
+        memset(counts, 0, sizeof(counts));
+        size_t end = n - start < block ? n : start + block;
+        size_t i = start;
+        for (; i + 4 <= end; i += 4) {
+            counts[0][p[i]]++;
+            counts[1][p[i + 1]]++;
+            counts[2][p[i + 2]]++;
+            counts[3][p[i + 3]]++;
+        }
+        for (; i < end; i++) {
+            counts[0][p[i]]++;
+        }
+        for (int v = 0; v < 256; v++) {
+            a->hist[s][v] += (uint64_t)counts[0][v] + counts[1][v] + counts[2][v] + counts[3][v];
+        }
+    }
+
+    for (int y = y0; y + 4 <= y1; y += 4) {
+        rs_quad(a, y, a->rs[s]);
+    }
+}
+
+// regularized upper incomplete gamma function Q(a, x)
+static double gamma_q(double a, double x) {
+    if (x <= 0) {
+        return 1.0;
+    }
+    double front = exp(-x + a * log(x) - lgamma(a));
+    if (x < a + 1) {
+        // series for P(a, x)
+        double ap = a, del = 1.0 / a, sum = del;
+        for (int n = 0; n < 1000; n++) {
+            ap += 1;
+            del *= x / ap;
+            sum += del;
+            if (fabs(del) < fabs(sum) * 1e-14) break;
+        }
+        return 1.0 - sum * front;
+    }
+    // continued fraction for Q(a, x) (modified Lentz)
+    const double tiny = 1e-300;
+    double b = x + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+    for (int i = 1; i < 1000; i++) {
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if (fabs(d) < tiny) d = tiny;
+        c = b + an / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1) < 1e-14) break;
+    }
+    return front * h;
+}
+
+// probability that the value pairs of hist are as even as random LSBs would make them
+static double chi_square_p(const uint64_t* hist) {
+    double chi = 0;
+    int categories = 0;
+    for (int k = 0; k < 128; k++) {
+        double expected = (hist[2 * k] + hist[2 * k + 1]) / 2.0;
+        if (expected > 4) {
+            double diff = hist[2 * k] - expected;
+            chi += diff * diff / expected;
+            categories++;
+        }
+    }
+    if (categories < 2) {
+        return 0;
+    }
+    return gamma_q((categories - 1) / 2.0, chi / 2);
+}
+
+// embedding rate from the RS counts of one channel
+static double rs_rate(const uint64_t* st) {
+    double d0 = (double)st[RM] - st[SM];
+    double d1 = (double)st[RM_FLIP] - st[SM_FLIP];
+    double n0 = (double)st[RNM] - st[SNM];
+    double n1 = (double)st[RNM_FLIP] - st[SNM_FLIP];
+    double a = 2 * (d1 + d0);
+    double b = n0 - n1 - d1 - 3 * d0;
+    double c = d0 - n0;
+
+    double x;
+    if (fabs(a) < 1e-9) {
+        if (fabs(b) < 1e-9) return 0;
+        x = -c / b;
+    } else {
+        double disc = b * b - 4 * a * c;
+        if (disc < 0) disc = 0;
+        double r1 = (-b + sqrt(disc)) / (2 * a);
+        double r2 = (-b - sqrt(disc)) / (2 * a);
+        x = fabs(r1) < fabs(r2) ? r1 : r2;
+    }
+    double rate = x / (x - 0.5);
+    if (!(rate > 0)) rate = 0;
+    if (rate > 1) rate = 1;
+    return rate;
+}
+
+// analyse one image and print its report
+// returns 0 on success, 1 if the image could not be read
+static int analyse_file(const char* filename, int numThreads, int verbose) {
+    int width, height, status;
+    struct ppm_pixel* pixels = read_ppm_status(filename, &width, &height, &status);
+    if (pixels == NULL) {
+        fprintf(stderr, "Error: %s: %s.\n", filename, ppm_strerror(status));
+        return 1;
+    }
+
+    struct analysis a;
+    a.data = (const unsigned char*)pixels;
+    a.width = width;
+    a.height = height;
+    a.row_bytes = (size_t)width * sizeof(struct ppm_pixel);
+    a.quads = height / 4;
+    a.segments = a.quads < MAX_SEGMENTS ? a.quads : MAX_SEGMENTS;
+    if (a.segments < 1) a.segments = 1;
+    a.hist = calloc(a.segments, sizeof(*a.hist));
+    a.rs = calloc(a.segments, sizeof(*a.rs));
+    if (a.hist == NULL || a.rs == NULL) {
+        fprintf(stderr, "Error: %s: Memory allocation failed.\n", filename);
+        free(a.hist);
+        free(a.rs);
+        free_ppm(pixels);
+        return 1;
+    }
+
+    batch_run(a.segments, numThreads, analyse_segment, &a);
+
+    // Sequential chi-square: the message occupies a prefix of the image, so
+    // the p of a growing prefix stays near 1 while it covers the message and
+    // falls once clean pixels dominate. It tends to run past the real end of
+    // the message; a single segment is too small a sample to do better.
+    uint64_t prefix[256] = {0};
+    uint64_t rs[3][RS_STATS] = {{0}};
+    double p = 0;
+    double chi_rate = 0;
+    int in_message = 1;
+    for (int s = 0; s < a.segments; s++) {
+        int y0, y1;
+        segment_rows(&a, s, &y0, &y1);
+        for (int v = 0; v < 256; v++) {
+            prefix[v] += a.hist[s][v];
+        }
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < RS_STATS; k++) {
+                rs[c][k] += a.rs[s][c][k];
+            }
+        }
+        p = chi_square_p(prefix);
+        double segment_p = chi_square_p(a.hist[s]);
+        double fraction = (double)y1 / height;
+        if (in_message && p >= 0.5) {
+            chi_rate = fraction;
+        } else {
+            in_message = 0;
+        }
+        if (verbose) {
+            printf("  rows %d-%d (prefix %5.1f%%): chi-square p=%.4f, prefix p=%.4f\n",
+                y0, y1 - 1, 100 * fraction, segment_p, p);
+        }
+    }
+
+    double rates[3];
+    for (int c = 0; c < 3; c++) {
+        rates[c] = rs_rate(rs[c]);
+    }
+    printf("%s: %dx%d, chi-square p=%.4f (p >= 0.5 over the first %.1f%% of rows), RS rate %.3f (R %.3f G %.3f B %.3f)\n",
+        filename, width, height, p, 100 * chi_rate, (rates[0] + rates[1] + rates[2]) / 3,
+        rates[0], rates[1], rates[2]);
+
+    free(a.hist);
+    free(a.rs);
+    free_ppm(pixels);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:v")) != -1) {
+        switch (opt) {
+            case 'j': numThreads = atoi(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                printf("usage: %s [-j threads] [-v] <file.ppm>...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-j threads] [-v] <file.ppm>...\n", argv[0]);
+        return 1;
+    }
+    if (numThreads < 1) numThreads = 1;
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++) {
+        failed |= analyse_file(argv[i], numThreads, verbose);
+    }
+    return failed;
+}
@@ -0,0 +1,223 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: Header and checksum helpers for binary payloads hidden with lsb.c. The header
+ * records the payload length so any bytes (including '\0') can be stored, and a CRC-32 after
+ * the payload lets decode tell a damaged or missing payload from a good one.
+ * Large payloads are split across a small pool of worker threads; every worker handles a
+ * contiguous band of the image, cut on channel group boundaries so no channel is shared.
+ ---------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stego.h"
+#include "lsb.h"
+
+static uint32_t crc_table[256];
+
+static void stego_init() __attribute__((constructor));
+
+void stego_init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+uint32_t stego_crc32(uint32_t crc, const unsigned char* buf, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint64_t stego_capacity(size_t channels, int bits) {
+    size_t reserved = 8 * STEGO_HEADER_BYTES + lsb_channels(STEGO_TRAILER_BYTES, bits);
+    if (channels < reserved) {
+        return 0;
+    }
+    size_t group = lsb_group_bytes(bits);
+    return (channels - reserved) / lsb_channels(group, bits) * group;
+}
+
+size_t stego_channel(uint64_t offset, int bits) {
+    size_t group = lsb_group_bytes(bits);
+    return 8 * STEGO_HEADER_BYTES + offset / group * lsb_channels(group, bits);
+}
+
+size_t stego_trailer_channel(uint64_t length, int bits) {
+    size_t group = lsb_group_bytes(bits);
+    return stego_channel((length + group - 1) / group * group, bits);
+}
+
+void stego_write_header(unsigned char* channels, const struct stego_header* hdr) {
+    unsigned char buf[STEGO_HEADER_BYTES];
+    memcpy(buf, STEGO_MAGIC, 3);
+    buf[3] = hdr->bits;
+    for (int i = 0; i < 8; i++) {
+        buf[4 + i] = hdr->length >> (56 - 8 * i);
+    }
+    lsb_embed(channels, buf, sizeof(buf));
+}
+
+int stego_read_header(const unsigned char* channels, struct stego_header* hdr) {
+    unsigned char buf[STEGO_HEADER_BYTES];
+    lsb_read(channels, buf, sizeof(buf));
+    if (memcmp(buf, STEGO_MAGIC, 3) != 0 || buf[3] < 1 || buf[3] > STEGO_MAX_BITS) {
+        return -1;
+    }
+    hdr->bits = buf[3];
+    hdr->length = 0;
+    for (int i = 0; i < 8; i++) {
+        hdr->length = (hdr->length << 8) | buf[4 + i];
+    }
+    return 0;
+}
+
+struct stego_pool {
+    int nthreads;
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;  // bumped for every job
+    int pending;               // workers still busy with the current job
+    int quit;
+
+    // the current job
+    int embed;
+    unsigned char* channels;
+    unsigned char* data;
+    size_t len;
+    int bits;
+};
+
+struct pool_worker {
+    struct stego_pool* pool;
+    int id;
+};
+
+static void run_band(struct stego_pool* pool, int id) {
+    size_t group = lsb_group_bytes(pool->bits);
+    size_t groups = (pool->len + group - 1) / group;
+    size_t per = (groups + pool->nthreads - 1) / pool->nthreads;
+    size_t first = per * id;
+    if (first >= groups) {
+        return;
+    }
+    size_t start = first * group;
+    size_t end = (first + per) * group;
+    if (end > pool->len) end = pool->len;
+    unsigned char* channels = pool->channels + first * lsb_channels(group, pool->bits);
+    if (pool->embed) {
+        lsb_embed_bits(channels, pool->data + start, end - start, pool->bits);
+    } else {
+        lsb_read_bits(channels, pool->data + start, end - start, pool->bits);
+    }
+}
+
+static void* pool_main(void* arg) {
+    struct pool_worker* worker = arg;
+    struct stego_pool* pool = worker->pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->quit) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_band(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(worker);
+    return NULL;
+}
+
+struct stego_pool* stego_pool_create(int nthreads) {
+    struct stego_pool* pool = calloc(1, sizeof(struct stego_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc(sizeof(pthread_t) * nthreads);
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        struct pool_worker* worker = malloc(sizeof(struct pool_worker));
+        if (worker != NULL) {
+            worker->pool = pool;
+            worker->id = i;
+        }
+        if (worker == NULL || pthread_create(&pool->threads[i], NULL, pool_main, worker) != 0) {
+            free(worker);
+            stego_pool_destroy(pool);
+            return NULL;
+        }
+        pool->nthreads = i + 1;
+    }
+    return pool;
+}
+
+static void pool_submit(struct stego_pool* pool, int embed, unsigned char* channels,
+                        unsigned char* data, size_t len, int bits) {
+    pthread_mutex_lock(&pool->lock);
+    pool->embed = embed;
+    pool->channels = channels;
+    pool->data = data;
+    pool->len = len;
+    pool->bits = bits;
+    pool->pending = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void stego_pool_embed(struct stego_pool* pool, unsigned char* channels,
+                      const unsigned char* msg, size_t len, int bits) {
+    pool_submit(pool, 1, channels, (unsigned char*)msg, len, bits);
+}
+
+void stego_pool_read(struct stego_pool* pool, const unsigned char* channels,
+                     unsigned char* out, size_t len, int bits) {
+    pool_submit(pool, 0, (unsigned char*)channels, out, len, bits);
+}
+
+void stego_pool_wait(struct stego_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void stego_pool_destroy(struct stego_pool* pool) {
+    stego_pool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,71 @@
+#ifndef STEGO_H_
+#define STEGO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of a binary payload hidden in an image (see lsb.h):
+//   "STG"             3 byte magic
+//   bits              1 byte, message bits stored per channel (1-4)
+//   length            8 byte big-endian payload size in bytes
+//   payload           length bytes
+//   crc               4 byte big-endian CRC-32 of the payload
+// The header always uses 1 bit per channel so it can be read before the
+// bits field is known; the payload and crc use 'bits' bits per channel, and
+// the crc starts on the next whole channel group after the payload.
+#define STEGO_MAGIC "STG"
+#define STEGO_HEADER_BYTES 12
+#define STEGO_TRAILER_BYTES 4
+#define STEGO_MAX_BITS 4
+
+struct stego_header {
+    int bits;
+    uint64_t length;
+};
+
+// number of payload bytes that fit in an image with the given number of
+// channel bytes, after the header and trailer
+extern uint64_t stego_capacity(size_t channels, int bits);
+
+// index of the channel holding payload byte 'offset'
+// offset: a multiple of lsb_group_bytes(bits), or the payload length
+extern size_t stego_channel(uint64_t offset, int bits);
+
+// index of the channel where the crc of a length byte payload starts
+extern size_t stego_trailer_channel(uint64_t length, int bits);
+
+// store hdr in the LSBs of channels[0 .. 8*STEGO_HEADER_BYTES)
+extern void stego_write_header(unsigned char* channels, const struct stego_header* hdr);
+
+// read a header back from channels
+// returns 0 on success, or -1 if the magic or bits field is not valid
+extern int stego_read_header(const unsigned char* channels, struct stego_header* hdr);
+
+// A fixed set of worker threads that embed or extract one buffer at a
+// time, each worker taking a contiguous band of the channels.
+struct stego_pool;
+
+// start nthreads workers
+// returns NULL if the threads cannot be created
+extern struct stego_pool* stego_pool_create(int nthreads);
+
+// start hiding len bytes of msg at channels (as lsb_embed_bits) and return
+// without waiting; msg and channels must stay untouched until stego_pool_wait
+extern void stego_pool_embed(struct stego_pool* pool, unsigned char* channels,
+    const unsigned char* msg, size_t len, int bits);
+
+// start recovering len bytes from channels into out (as lsb_read_bits)
+extern void stego_pool_read(struct stego_pool* pool, const unsigned char* channels,
+    unsigned char* out, size_t len, int bits);
+
+// wait for the job started last to finish
+extern void stego_pool_wait(struct stego_pool* pool);
+
+// stop the workers and free the pool
+extern void stego_pool_destroy(struct stego_pool* pool);
+
+// continue a CRC-32 (as used by zlib and PNG) over len more bytes
+// crc: 0 to start, or the value returned by the previous call
+extern uint32_t stego_crc32(uint32_t crc, const unsigned char* buf, size_t len);
+
+#endif
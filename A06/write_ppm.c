@@ -8,18 +8,26 @@
 #include <stdlib.h>
 #include "read_ppm.h"
 
-void write_ppm(const char* filename, struct ppm_pixel* pixels, int width, int height) {
+int write_ppm_status(const char* filename, struct ppm_pixel* pixels, int width, int height) {
     FILE* fp = fopen(filename, "wb");
     if (fp == NULL) {
-        fprintf(stderr, "Error: Could not open file %s for writing.\n", filename);
-        return;
+        return -1;
     }
 
-    fprintf(fp, "P6\n%d %d\n255\n", width, height);
-
-    fwrite(pixels, sizeof(struct ppm_pixel), width * height, fp);
+    size_t count = (size_t)width * height;
+    int ok = fprintf(fp, "P6\n%d %d\n255\n", width, height) > 0;
+    ok = ok && fwrite(pixels, sizeof(struct ppm_pixel), count, fp) == count;
+    // a full disk may only show up when the last buffer is flushed
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
 
-    fclose(fp);
+void write_ppm(const char* filename, struct ppm_pixel* pixels, int width, int height) {
+    if (write_ppm_status(filename, pixels, width, height) != 0) {
+        fprintf(stderr, "Error: Could not write file %s.\n", filename);
+    }
 }
 void write_ppm_2d(const char* filename, struct ppm_pixel** pixels, int w, int h) {
 
@@ -10,6 +10,10 @@
 // h: the height of the image
 extern void write_ppm(const char* filename, struct ppm_pixel* pxs, int w, int h);
 
+// write in a PPM file in binary format, like write_ppm, but without printing
+// returns 0, or -1 if the file could not be opened, written or closed
+extern int write_ppm_status(const char* filename, struct ppm_pixel* pxs, int w, int h);
+
 // write in a PPM file in binary format
 // filename: the file to save to
 // pxs: a 2D array of ppm_pixel to save
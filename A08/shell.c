@@ -22,6 +22,33 @@ const char* colors[] = {
     "\001\033[0m\002"
 };
 
+#ifdef USE_SLAB
+#include "../A12/slab.h"
+
+// every command gets an argument array of the same size, so they come from
+// a slab pool (make SLAB=1)
+static struct slab_pool* args_pool = NULL;
+
+char** alloc_args() {
+    if (args_pool == NULL) {
+        args_pool = slab_create(MAX_ARGS * sizeof(char*));
+    }
+    return args_pool != NULL ? slab_alloc(args_pool) : NULL;
+}
+
+void free_args_array(char** args) {
+    slab_free(args_pool, args);
+}
+#else
+char** alloc_args() {
+    return malloc(MAX_ARGS * sizeof(char*));
+}
+
+void free_args_array(char** args) {
+    free(args);
+}
+#endif
+
 char* get_prompt() {
     static char cwd[PATH_MAX];
     static char prompt[PATH_MAX + 100];
@@ -40,7 +67,7 @@ char* get_prompt() {
 }
 
 char** split_command(char* line, int* arg_count) {
-    char** args = malloc(MAX_ARGS * sizeof(char*));
+    char** args = alloc_args();
     char* token;
     *arg_count = 0;
 
@@ -59,7 +86,7 @@ void free_args(char** args, int arg_count) {
     for (int i = 0; i < arg_count; i++) {
         free(args[i]);
     }
-    free(args);
+    free_args_array(args);
 }
 
 int main() {
@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "async_write.h"
+#include "write_image.h"
+
+// O_DIRECT transfers must be block aligned in address, offset and length,
+// so direct writes go through an aligned staging buffer.
+#define STAGE_SIZE (1 << 20)
+#define DIRECT_ALIGN 4096
+
+struct write_job {
+  char* filename;
+  struct ppm_pixel* pxs;
+  int w, h;
+};
+
+struct async_writer {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  struct write_job* jobs;  // ring buffer of depth entries
+  int depth;
+  int head, count;
+  int flags;
+  int stopping;
+  int failures;
+};
+
+static int pwrite_all(int fd, const void* buf, size_t len, off_t offset) {
+  const char* p = buf;
+  while (len > 0) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+static int write_direct(int fd, const char* header, size_t header_len,
+                        const unsigned char* data, size_t data_len) {
+  unsigned char* stage;
+  if (posix_memalign((void**)&stage, DIRECT_ALIGN, STAGE_SIZE) != 0) return -1;
+
+  memcpy(stage, header, header_len);
+  size_t fill = header_len;
+  off_t offset = 0;
+  size_t total = header_len + data_len;
+  int result = 0;
+
+  while (result == 0 && data_len > 0) {
+    size_t n = STAGE_SIZE - fill < data_len ? STAGE_SIZE - fill : data_len;
+    memcpy(stage + fill, data, n);
+    fill += n;
+    data += n;
+    data_len -= n;
+
+    if (fill == STAGE_SIZE || data_len == 0) {
+      // the tail is padded to a whole block and trimmed afterwards
+      size_t len = (fill + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+      memset(stage + fill, 0, len - fill);
+      result = pwrite_all(fd, stage, len, offset);
+      offset += len;
+      fill = 0;
+    }
+  }
+  if (result == 0) result = ftruncate(fd, total);
+
+  free(stage);
+  return result;
+}
+
+static int write_ppm_file(const char* filename, struct ppm_pixel* pxs, int w, int h, int flags) {
+  char header[64];
+  size_t header_len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", w, h);
+  size_t data_len = (size_t)w * h * sizeof(struct ppm_pixel);
+
+  if (flags & ASYNC_WRITE_DIRECT) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0) {
+      int result = write_direct(fd, header, header_len, (unsigned char*)pxs, data_len);
+      close(fd);
+      if (result == 0) return 0;
+      // some file systems accept O_DIRECT at open but reject the writes
+    }
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Error: unable to open file '%s' for writing\n", filename);
+    return -1;
+  }
+  int result = pwrite_all(fd, header, header_len, 0);
+  if (result == 0) result = pwrite_all(fd, pxs, data_len, header_len);
+  if (close(fd) != 0) result = -1;
+  if (result != 0) {
+    printf("Error: unable to write pixel data to '%s'\n", filename);
+  }
+  return result;
+}
+
+static void* writer_main(void* arg) {
+  struct async_writer* aw = (struct async_writer*)arg;
+
+  pthread_mutex_lock(&aw->mutex);
+  while (1) {
+    while (aw->count == 0 && !aw->stopping) {
+      pthread_cond_wait(&aw->not_empty, &aw->mutex);
+    }
+    if (aw->count == 0) break;  // stopping and drained
+    struct write_job job = aw->jobs[aw->head];
+    pthread_mutex_unlock(&aw->mutex);
+
+    int result;
+    const char* ext = strrchr(job.filename, '.');
+    if (ext == NULL || strcasecmp(ext, ".ppm") == 0) {
+      result = write_ppm_file(job.filename, job.pxs, job.w, job.h, aw->flags);
+    } else {
+      result = write_image(job.filename, job.pxs, job.w, job.h);
+    }
+    free(job.pxs);
+    free(job.filename);
+
+    // the slot is released only after the write, so at most depth images
+    // are held in memory at once
+    pthread_mutex_lock(&aw->mutex);
+    if (result != 0) aw->failures++;
+    aw->head = (aw->head + 1) % aw->depth;
+    aw->count--;
+    pthread_cond_signal(&aw->not_full);
+  }
+  pthread_mutex_unlock(&aw->mutex);
+  return NULL;
+}
+
+struct async_writer* async_writer_start(int depth, int flags) {
+  if (depth < 1) depth = 1;
+  struct async_writer* aw = calloc(1, sizeof(struct async_writer));
+  if (!aw) return NULL;
+  aw->jobs = malloc(depth * sizeof(struct write_job));
+  if (!aw->jobs) {
+    free(aw);
+    return NULL;
+  }
+  aw->depth = depth;
+  aw->flags = flags;
+  pthread_mutex_init(&aw->mutex, NULL);
+  pthread_cond_init(&aw->not_empty, NULL);
+  pthread_cond_init(&aw->not_full, NULL);
+  if (pthread_create(&aw->thread, NULL, writer_main, aw) != 0) {
+    pthread_mutex_destroy(&aw->mutex);
+    pthread_cond_destroy(&aw->not_empty);
+    pthread_cond_destroy(&aw->not_full);
+    free(aw->jobs);
+    free(aw);
+    return NULL;
+  }
+  return aw;
+}
+
+void async_write(struct async_writer* aw, const char* filename,
+                 struct ppm_pixel* pxs, int w, int h) {
+  struct write_job job = {strdup(filename), pxs, w, h};
+
+  pthread_mutex_lock(&aw->mutex);
+  if (job.filename == NULL) {
+    aw->failures++;
+    pthread_mutex_unlock(&aw->mutex);
+    free(pxs);
+    return;
+  }
+  while (aw->count == aw->depth) {
+    pthread_cond_wait(&aw->not_full, &aw->mutex);
+  }
+  aw->jobs[(aw->head + aw->count) % aw->depth] = job;
+  aw->count++;
+  pthread_cond_signal(&aw->not_empty);
+  pthread_mutex_unlock(&aw->mutex);
+}
+
+int async_writer_finish(struct async_writer* aw) {
+  pthread_mutex_lock(&aw->mutex);
+  aw->stopping = 1;
+  pthread_cond_signal(&aw->not_empty);
+  pthread_mutex_unlock(&aw->mutex);
+  pthread_join(aw->thread, NULL);
+
+  int failures = aw->failures;
+  pthread_mutex_destroy(&aw->mutex);
+  pthread_cond_destroy(&aw->not_empty);
+  pthread_cond_destroy(&aw->not_full);
+  free(aw->jobs);
+  free(aw);
+  return failures;
+}
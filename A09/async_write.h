@@ -0,0 +1,32 @@
+#ifndef async_write_H_
+#define async_write_H_
+
+#include "read_ppm.h"
+
+// open the output with O_DIRECT (bypassing the page cache) when the file
+// system supports it; otherwise the writer silently uses buffered pwrite
+#define ASYNC_WRITE_DIRECT 1
+
+struct async_writer;
+
+// start a background writer thread
+// depth: how many images may be queued before async_write blocks
+//        (2 gives double buffering: one being written, one waiting)
+// flags: 0 or ASYNC_WRITE_DIRECT
+// returns the writer, or NULL if it could not be started
+extern struct async_writer* async_writer_start(int depth, int flags);
+
+// queue an image to be written; the format follows the file extension
+// filename: the file to save to (copied)
+// pxs: a 1D array of ppm_pixel; ownership passes to the writer, which
+//      frees it once the image is on disk
+// w: the width of the image
+// h: the height of the image
+extern void async_write(struct async_writer* aw, const char* filename,
+    struct ppm_pixel* pxs, int w, int h);
+
+// wait for all queued images to be written and stop the writer thread
+// returns the number of images that could not be written
+extern int async_writer_finish(struct async_writer* aw);
+
+#endif
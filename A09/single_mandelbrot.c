@@ -5,6 +5,7 @@
 #include <sys/time.h>
 #include "read_ppm.h"   
 #include "write_ppm.h"
+#include "write_image.h"
 
 int main(int argc, char* argv[]) {
   int size = 2000;
@@ -13,17 +14,19 @@ int main(int argc, char* argv[]) {
   float ymin = -1.12;
   float ymax = 1.12;
   int maxIterations = 1000;
+  const char* format = "ppm";
 
   // Parse command-line arguments
   int opt;
-  while ((opt = getopt(argc, argv, ":s:l:r:t:b:")) != -1) {
+  while ((opt = getopt(argc, argv, ":s:l:r:t:b:f:")) != -1) {
     switch (opt) {
       case 's': size = atoi(optarg); break;
       case 'l': xmin = atof(optarg); break;
       case 'r': xmax = atof(optarg); break;
       case 't': ymax = atof(optarg); break;
       case 'b': ymin = atof(optarg); break;
-      case '?': printf("usage: %s -s <size> -l <xmin> -r <xmax> -b <ymin> -t <ymax>\n", argv[0]); return -1;
+      case 'f': format = optarg; break;
+      case '?': printf("usage: %s -s <size> -l <xmin> -r <xmax> -b <ymin> -t <ymax> -f <ppm|png|qoi>\n", argv[0]); return -1;
     }
   }
   
@@ -88,9 +91,9 @@ int main(int argc, char* argv[]) {
 
   // Generate output filename with timestamp
   char filename[64];
-  snprintf(filename, sizeof(filename), "mandelbrot-%d-%ld.ppm", size, time(0));
+  snprintf(filename, sizeof(filename), "mandelbrot-%d-%ld.%s", size, time(0), format);
 
-  write_ppm(filename, pixels, size, size);
+  write_image(filename, pixels, size, size);
   printf("Writing file: %s\n", filename);
 
   free(pixels);
@@ -6,6 +6,9 @@
 #include <pthread.h>
 #include "read_ppm.h"
 #include "write_ppm.h"
+#include "write_image.h"
+#include "async_write.h"
+#include "tiled_image.h"
 
 #define MAX_ITER 1000
 
@@ -16,6 +19,8 @@ typedef struct {
     float xmin, xmax, ymin, ymax;
     int size;
     struct ppm_pixel* image;
+    int tile_x, tile_y;
+    struct tiled_writer* tiles;  // NULL unless a tiled copy was requested
 } ThreadData;
 
 int mandelbrot(float c_real, float c_imag, int max_iter) {
@@ -50,6 +55,12 @@ void* compute_mandelbrot(void* arg) {
         }
     }
 
+    // Each thread's block is one tile of the tiled copy
+    if (data->tiles) {
+        tiled_write_tile(data->tiles, data->tile_x, data->tile_y,
+                         &data->image[data->start_row * width + data->start_col], width);
+    }
+
     // Print thread info
     pthread_t thread_id = pthread_self();
     printf("Thread %lu) sub-image block: cols (%d, %d) to rows (%d, %d)\n",
@@ -62,17 +73,23 @@ int main(int argc, char* argv[]) {
     int size = 2000;
     float xmin = -2.0, xmax = 0.47, ymin = -1.12, ymax = 1.12;
     int numThreads = 4;
+    const char* format = "ppm";
+    int writeFlags = 0;
+    int tiled = 0;
 
     int opt;
-    while ((opt = getopt(argc, argv, ":s:l:r:t:b:")) != -1) {
+    while ((opt = getopt(argc, argv, ":s:l:r:t:b:f:dT")) != -1) {
         switch (opt) {
             case 's': size = atoi(optarg); break;
             case 'l': xmin = atof(optarg); break;
             case 'r': xmax = atof(optarg); break;
             case 't': ymax = atof(optarg); break;
             case 'b': ymin = atof(optarg); break;
+            case 'f': format = optarg; break;
+            case 'd': writeFlags |= ASYNC_WRITE_DIRECT; break;
+            case 'T': tiled = 1; break;
             case '?': printf("usage: %s -s <size> -l <xmin> -r <xmax> "
-                              "-b <ymin> -t <ymax> -p <numThreads>\n", argv[0]); break;
+                              "-b <ymin> -t <ymax> -p <numThreads> -f <ppm|png|qoi> [-d] [-T]\n", argv[0]); break;
         }
     }
 
@@ -94,12 +111,38 @@ int main(int argc, char* argv[]) {
     ThreadData* threadData = (ThreadData*)malloc(numThreads * sizeof(ThreadData));
     if (!threads || !threadData) {
         fprintf(stderr, "Failed to allocate memory for threads or thread data\n");
+        free(threads);
+        free(threadData);
         free(image);
         return 1;
     }
 
-    int rows_per_thread = size / 2;
-    int cols_per_thread = size / 2;
+    // Images are flushed by a background thread so the caller can move on
+    struct async_writer* writer = async_writer_start(2, writeFlags);
+    if (!writer) {
+        fprintf(stderr, "Failed to start image writer\n");
+        free(threads);
+        free(threadData);
+        free(image);
+        return 1;
+    }
+
+    // Round up so odd sizes are fully covered; the last row/column of
+    // blocks is clipped to the image
+    int rows_per_thread = (size + 1) / 2;
+    int cols_per_thread = (size + 1) / 2;
+
+    time_t now = time(NULL);
+    struct tm* time_info = localtime(&now);
+    char timestamp[64];
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d%H%M%S", time_info);
+
+    struct tiled_writer* tiles = NULL;
+    char tiles_filename[100];
+    if (tiled) {
+        snprintf(tiles_filename, sizeof(tiles_filename), "mandelbrot-%dx%d-%s.til", size, size, timestamp);
+        tiles = tiled_create(tiles_filename, size, size, cols_per_thread, rows_per_thread, TILED_RLE);
+    }
 
     // Start time measurement
     clock_t start_time = clock();
@@ -111,12 +154,17 @@ int main(int argc, char* argv[]) {
         threadData[i].ymax = ymax;
         threadData[i].size = size;
         threadData[i].image = image;
+        threadData[i].tiles = tiles;
+        threadData[i].tile_x = i % 2;
+        threadData[i].tile_y = i / 2;
 
         // Divide the image into quadrants and assign each thread a sub-region
         threadData[i].start_row = (i / 2) * rows_per_thread;
         threadData[i].end_row = (i / 2 + 1) * rows_per_thread;
+        if (threadData[i].end_row > size) threadData[i].end_row = size;
         threadData[i].start_col = (i % 2) * cols_per_thread;
         threadData[i].end_col = (i % 2 + 1) * cols_per_thread;
+        if (threadData[i].end_col > size) threadData[i].end_col = size;
 
         // Create thread
         pthread_create(&threads[i], NULL, compute_mandelbrot, (void*)&threadData[i]);
@@ -130,17 +178,28 @@ int main(int argc, char* argv[]) {
     double time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
     printf("Computed mandelbrot set (%dx%d) in %.6f seconds\n", size, size, time_taken);
 
-    time_t now = time(NULL);
-    struct tm* time_info = localtime(&now);
+    if (tiles) {
+        if (tiled_close(tiles) == 0) {
+            printf("Writing file: %s\n", tiles_filename);
+        } else {
+            fprintf(stderr, "Failed to write %s\n", tiles_filename);
+        }
+    }
+
     char filename[100];
-    strftime(filename, sizeof(filename), "mandelbrot-%dx%d-%Y%m%d%H%M%S.ppm", time_info);
+    snprintf(filename, sizeof(filename), "mandelbrot-%dx%d-%s.%s", size, size, timestamp, format);
 
-    write_ppm(filename, image, size, size);
+    // The writer owns (and frees) the image from here on
+    async_write(writer, filename, image, size, size);
     printf("Writing file: %s\n", filename);
 
     free(threads);
     free(threadData);
-    free(image);
+
+    if (async_writer_finish(writer) != 0) {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        return 1;
+    }
 
     return 0;
 }
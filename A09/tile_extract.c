@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "read_ppm.h"
+#include "write_image.h"
+#include "tiled_image.h"
+
+// Pulls a single tile out of a tiled render without reading the rest of
+// the file, e.g. to inspect one region of a very large image.
+int main(int argc, char* argv[]) {
+  if (argc != 5) {
+    printf("usage: %s <file.til> <x> <y> <output.(ppm|png|qoi)>\n", argv[0]);
+    return 1;
+  }
+
+  struct tiled_image* ti = tiled_open(argv[1]);
+  if (!ti) {
+    return 1;
+  }
+
+  int w, h, tile_w, tile_h;
+  tiled_info(ti, &w, &h, &tile_w, &tile_h);
+  printf("Reading %s with size %dx%d in %dx%d tiles\n", argv[1], w, h, tile_w, tile_h);
+
+  int tw, th, x0, y0;
+  struct ppm_pixel* tile = tiled_read_tile(ti, atoi(argv[2]), atoi(argv[3]), &tw, &th, &x0, &y0);
+  tiled_free(ti);
+  if (!tile) {
+    return 1;
+  }
+
+  printf("Tile at (%d, %d) has size %dx%d\n", x0, y0, tw, th);
+  int result = write_image(argv[4], tile, tw, th);
+  if (result == 0) {
+    printf("Writing file: %s\n", argv[4]);
+  }
+  free(tile);
+  return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tiled_image.h"
+
+#define HEADER_SIZE 24
+#define ENTRY_SIZE 16
+
+struct tile_entry {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t encoding;
+  int written;
+};
+
+struct tiled_writer {
+  int fd;
+  pthread_mutex_t mutex;
+  int w, h, tile_w, tile_h;
+  int tiles_x, tiles_y;
+  int compression;
+  uint64_t end;  // next free byte for a tile block
+  int failed;
+  struct tile_entry* entries;
+};
+
+struct tiled_image {
+  int fd;
+  int w, h, tile_w, tile_h;
+  int tiles_x, tiles_y;
+  struct tile_entry* entries;
+};
+
+static void put_le32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put_le64(unsigned char* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static uint32_t get_le32(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const unsigned char* p) {
+  return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static int pwrite_all(int fd, const void* buf, size_t len, off_t offset) {
+  const char* p = buf;
+  while (len > 0) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+static int pread_all(int fd, void* buf, size_t len, off_t offset) {
+  char* p = buf;
+  while (len > 0) {
+    ssize_t n = pread(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+static int same_pixel(const struct ppm_pixel* a, const struct ppm_pixel* b) {
+  return a->red == b->red && a->green == b->green && a->blue == b->blue;
+}
+
+// Run-length code: a control byte c < 128 is followed by c+1 literal
+// pixels; c >= 128 is followed by one pixel repeated c-126 times (2..129).
+static size_t rle_encode(const struct ppm_pixel* px, size_t n, unsigned char* out) {
+  size_t i = 0, o = 0;
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && run < 129 && same_pixel(&px[i + run], &px[i])) run++;
+    if (run >= 2) {
+      out[o++] = 126 + run;
+      memcpy(out + o, &px[i], 3);
+      o += 3;
+      i += run;
+      continue;
+    }
+
+    size_t start = i, count = 0;
+    while (i < n && count < 128) {
+      if (i + 1 < n && same_pixel(&px[i], &px[i + 1])) break;
+      i++;
+      count++;
+    }
+    out[o++] = count - 1;
+    memcpy(out + o, &px[start], count * 3);
+    o += count * 3;
+  }
+  return o;
+}
+
+static int rle_decode(const unsigned char* in, size_t len, struct ppm_pixel* px, size_t n) {
+  size_t i = 0, o = 0;
+  while (i < len && o < n) {
+    unsigned char c = in[i++];
+    if (c < 128) {
+      size_t count = c + 1;
+      if (o + count > n || i + count * 3 > len) return -1;
+      memcpy(&px[o], in + i, count * 3);
+      i += count * 3;
+      o += count;
+    } else {
+      size_t count = c - 126;
+      if (o + count > n || i + 3 > len) return -1;
+      for (size_t k = 0; k < count; k++) memcpy(&px[o + k], in + i, 3);
+      i += 3;
+      o += count;
+    }
+  }
+  return (o == n && i == len) ? 0 : -1;
+}
+
+static void tile_size(int w, int h, int tile_w, int tile_h, int tx, int ty, int* cw, int* ch) {
+  *cw = (tx + 1) * tile_w <= w ? tile_w : w - tx * tile_w;
+  *ch = (ty + 1) * tile_h <= h ? tile_h : h - ty * tile_h;
+}
+
+struct tiled_writer* tiled_create(const char* filename, int w, int h,
+                                  int tile_w, int tile_h, int compression) {
+  if (w <= 0 || h <= 0 || tile_w <= 0 || tile_h <= 0) {
+    printf("Error: invalid tiled image dimensions\n");
+    return NULL;
+  }
+  struct tiled_writer* tw = calloc(1, sizeof(struct tiled_writer));
+  if (!tw) return NULL;
+  tw->w = w;
+  tw->h = h;
+  tw->tile_w = tile_w;
+  tw->tile_h = tile_h;
+  tw->tiles_x = (w + tile_w - 1) / tile_w;
+  tw->tiles_y = (h + tile_h - 1) / tile_h;
+  tw->compression = compression;
+  tw->end = HEADER_SIZE + (uint64_t)ENTRY_SIZE * tw->tiles_x * tw->tiles_y;
+  tw->entries = calloc((size_t)tw->tiles_x * tw->tiles_y, sizeof(struct tile_entry));
+  tw->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (!tw->entries || tw->fd < 0) {
+    printf("Error: unable to open file '%s' for writing\n", filename);
+    if (tw->fd >= 0) close(tw->fd);
+    free(tw->entries);
+    free(tw);
+    return NULL;
+  }
+  pthread_mutex_init(&tw->mutex, NULL);
+  return tw;
+}
+
+int tiled_write_tile(struct tiled_writer* tw, int tx, int ty,
+                     const struct ppm_pixel* pxs, int stride) {
+  if (tx < 0 || tx >= tw->tiles_x || ty < 0 || ty >= tw->tiles_y) return -1;
+
+  int cw, ch;
+  tile_size(tw->w, tw->h, tw->tile_w, tw->tile_h, tx, ty, &cw, &ch);
+  size_t n = (size_t)cw * ch;
+
+  // gather the tile rows, then try to compress them
+  struct ppm_pixel* tile = malloc(n * sizeof(struct ppm_pixel));
+  unsigned char* packed = NULL;
+  if (tw->compression == TILED_RLE) packed = malloc(n * 3 + n / 128 + 1);
+  if (!tile || (tw->compression == TILED_RLE && !packed)) {
+    free(tile);
+    free(packed);
+    pthread_mutex_lock(&tw->mutex);
+    tw->failed = 1;
+    pthread_mutex_unlock(&tw->mutex);
+    return -1;
+  }
+  for (int row = 0; row < ch; row++) {
+    memcpy(&tile[(size_t)row * cw], &pxs[(size_t)row * stride], cw * sizeof(struct ppm_pixel));
+  }
+
+  const void* block = tile;
+  size_t length = n * 3;
+  uint32_t encoding = TILED_RAW;
+  if (packed) {
+    size_t packed_len = rle_encode(tile, n, packed);
+    if (packed_len < length) {
+      block = packed;
+      length = packed_len;
+      encoding = TILED_RLE;
+    }
+  }
+
+  // only the space reservation is serialized; the data goes out with pwrite
+  pthread_mutex_lock(&tw->mutex);
+  uint64_t offset = tw->end;
+  tw->end += length;
+  pthread_mutex_unlock(&tw->mutex);
+
+  int result = pwrite_all(tw->fd, block, length, offset);
+
+  pthread_mutex_lock(&tw->mutex);
+  struct tile_entry* e = &tw->entries[(size_t)ty * tw->tiles_x + tx];
+  if (result == 0) {
+    e->offset = offset;
+    e->length = length;
+    e->encoding = encoding;
+    e->written = 1;
+  } else {
+    tw->failed = 1;
+  }
+  pthread_mutex_unlock(&tw->mutex);
+
+  free(tile);
+  free(packed);
+  return result;
+}
+
+int tiled_close(struct tiled_writer* tw) {
+  size_t count = (size_t)tw->tiles_x * tw->tiles_y;
+  size_t len = HEADER_SIZE + count * ENTRY_SIZE;
+  unsigned char* head = malloc(len);
+  int result = tw->failed ? -1 : 0;
+
+  if (head) {
+    memcpy(head, "TIL1", 4);
+    put_le32(head + 4, tw->w);
+    put_le32(head + 8, tw->h);
+    put_le32(head + 12, tw->tile_w);
+    put_le32(head + 16, tw->tile_h);
+    put_le32(head + 20, tw->compression);
+    for (size_t i = 0; i < count; i++) {
+      unsigned char* p = head + HEADER_SIZE + i * ENTRY_SIZE;
+      if (!tw->entries[i].written) result = -1;
+      put_le64(p, tw->entries[i].offset);
+      put_le32(p + 8, tw->entries[i].length);
+      put_le32(p + 12, tw->entries[i].encoding);
+    }
+    if (pwrite_all(tw->fd, head, len, 0) != 0) result = -1;
+    free(head);
+  } else {
+    result = -1;
+  }
+
+  if (close(tw->fd) != 0) result = -1;
+  pthread_mutex_destroy(&tw->mutex);
+  free(tw->entries);
+  free(tw);
+  return result;
+}
+
+struct tiled_image* tiled_open(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Error: unable to open file '%s'\n", filename);
+    return NULL;
+  }
+
+  unsigned char head[HEADER_SIZE];
+  struct tiled_image* ti = calloc(1, sizeof(struct tiled_image));
+  if (!ti || pread_all(fd, head, HEADER_SIZE, 0) != 0 || memcmp(head, "TIL1", 4) != 0) {
+    printf("Error: '%s' is not a tiled image\n", filename);
+    free(ti);
+    close(fd);
+    return NULL;
+  }
+  ti->fd = fd;
+  ti->w = get_le32(head + 4);
+  ti->h = get_le32(head + 8);
+  ti->tile_w = get_le32(head + 12);
+  ti->tile_h = get_le32(head + 16);
+  if (ti->w <= 0 || ti->h <= 0 || ti->tile_w <= 0 || ti->tile_h <= 0) {
+    printf("Error: '%s' has invalid dimensions\n", filename);
+    tiled_free(ti);
+    return NULL;
+  }
+  ti->tiles_x = (ti->w + ti->tile_w - 1) / ti->tile_w;
+  ti->tiles_y = (ti->h + ti->tile_h - 1) / ti->tile_h;
+
+  size_t count = (size_t)ti->tiles_x * ti->tiles_y;
+  unsigned char* index = malloc(count * ENTRY_SIZE);
+  ti->entries = calloc(count, sizeof(struct tile_entry));
+  if (!index || !ti->entries || pread_all(fd, index, count * ENTRY_SIZE, HEADER_SIZE) != 0) {
+    printf("Error: unable to read the tile index of '%s'\n", filename);
+    free(index);
+    tiled_free(ti);
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const unsigned char* p = index + i * ENTRY_SIZE;
+    ti->entries[i].offset = get_le64(p);
+    ti->entries[i].length = get_le32(p + 8);
+    ti->entries[i].encoding = get_le32(p + 12);
+    ti->entries[i].written = 1;
+  }
+  free(index);
+  return ti;
+}
+
+void tiled_info(struct tiled_image* ti, int* w, int* h, int* tile_w, int* tile_h) {
+  *w = ti->w;
+  *h = ti->h;
+  *tile_w = ti->tile_w;
+  *tile_h = ti->tile_h;
+}
+
+struct ppm_pixel* tiled_read_tile(struct tiled_image* ti, int x, int y,
+                                  int* tw, int* th, int* x0, int* y0) {
+  if (x < 0 || x >= ti->w || y < 0 || y >= ti->h) {
+    printf("Error: pixel (%d, %d) is outside the image\n", x, y);
+    return NULL;
+  }
+  int tx = x / ti->tile_w;
+  int ty = y / ti->tile_h;
+  int cw, ch;
+  tile_size(ti->w, ti->h, ti->tile_w, ti->tile_h, tx, ty, &cw, &ch);
+  size_t n = (size_t)cw * ch;
+
+  struct tile_entry* e = &ti->entries[(size_t)ty * ti->tiles_x + tx];
+  if ((e->encoding == TILED_RAW && e->length != n * 3) ||
+      (e->encoding == TILED_RLE && e->length > n * 3) || e->encoding > TILED_RLE) {
+    printf("Error: tile (%d, %d) is corrupt\n", tx, ty);
+    return NULL;
+  }
+
+  struct ppm_pixel* pixels = malloc(n * sizeof(struct ppm_pixel));
+  unsigned char* block = e->encoding == TILED_RLE ? malloc(e->length) : (unsigned char*)pixels;
+  if (!pixels || !block) {
+    printf("Error: unable to allocate memory\n");
+    free(pixels);
+    return NULL;
+  }
+
+  int result = pread_all(ti->fd, block, e->length, e->offset);
+  if (result == 0 && e->encoding == TILED_RLE) {
+    result = rle_decode(block, e->length, pixels, n);
+  }
+  if (block != (unsigned char*)pixels) free(block);
+  if (result != 0) {
+    printf("Error: tile (%d, %d) is corrupt\n", tx, ty);
+    free(pixels);
+    return NULL;
+  }
+
+  *tw = cw;
+  *th = ch;
+  *x0 = tx * ti->tile_w;
+  *y0 = ty * ti->tile_h;
+  return pixels;
+}
+
+void tiled_free(struct tiled_image* ti) {
+  if (ti == NULL) return;
+  close(ti->fd);
+  free(ti->entries);
+  free(ti);
+}
@@ -0,0 +1,57 @@
+#ifndef tiled_image_H_
+#define tiled_image_H_
+
+#include "read_ppm.h"
+
+// Tiled raster (.til) layout, all integers little-endian:
+//   "TIL1" width height tile_w tile_h compression      (24 byte header)
+//   index: one entry per tile in row-major tile order  (16 bytes each)
+//     u64 offset, u32 stored length, u32 encoding
+//   tile blocks, in whatever order they were written
+// Tiles on the right and bottom edges are clipped to the image.
+// A tile's block is either raw RGB triples or run-length encoded pixels,
+// whichever is smaller.
+
+#define TILED_RAW 0
+#define TILED_RLE 1
+
+struct tiled_writer;
+struct tiled_image;
+
+// create a tiled file; tiles may then be written in any order, from any
+// thread
+// compression: TILED_RAW or TILED_RLE
+// returns the writer, or NULL if the file cannot be created
+extern struct tiled_writer* tiled_create(const char* filename, int w, int h,
+    int tile_w, int tile_h, int compression);
+
+// store one tile
+// tx, ty: tile column and row
+// pxs: the tile's top-left pixel inside a larger image
+// stride: the width (in pixels) of that larger image
+// returns 0 on success, -1 on failure
+extern int tiled_write_tile(struct tiled_writer* tw, int tx, int ty,
+    const struct ppm_pixel* pxs, int stride);
+
+// write the tile index and close the file
+// returns 0 on success, -1 if any tile failed or was never written
+extern int tiled_close(struct tiled_writer* tw);
+
+// open a tiled file and load its index (tile data is read on demand)
+// returns NULL if the file is missing or malformed
+extern struct tiled_image* tiled_open(const char* filename);
+
+// image and tile dimensions of an open tiled file
+extern void tiled_info(struct tiled_image* ti, int* w, int* h, int* tile_w, int* tile_h);
+
+// read the tile containing pixel (x, y)
+// tw, th: pointer arguments for returning the tile's (clipped) size
+// x0, y0: pointer arguments for returning the tile's top-left pixel
+// returns a 1D array of ppm_pixel, or NULL on failure
+// NOTE: Caller is responsible for freeing the returned array
+extern struct ppm_pixel* tiled_read_tile(struct tiled_image* ti, int x, int y,
+    int* tw, int* th, int* x0, int* y0);
+
+extern void tiled_free(struct tiled_image* ti);
+
+#endif
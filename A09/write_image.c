@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "write_ppm.h"
+#include "write_image.h"
+
+int write_image(const char* filename, struct ppm_pixel* pxs, int w, int h) {
+  const char* ext = strrchr(filename, '.');
+  if (ext != NULL && strcasecmp(ext, ".png") == 0) {
+    return write_png(filename, pxs, w, h);
+  }
+  if (ext != NULL && strcasecmp(ext, ".qoi") == 0) {
+    return write_qoi(filename, pxs, w, h);
+  }
+
+  // write_ppm reports its own errors
+  write_ppm(filename, pxs, w, h);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef write_image_H_
+#define write_image_H_
+
+#include "read_ppm.h"
+
+// write a PNG file (8-bit RGB) using the built-in deflate encoder
+// filename: the file to save to
+// pxs: a 1D array of ppm_pixel to save
+// w: the width of the image
+// h: the height of the image
+// returns 0 on success, -1 if the file could not be written
+extern int write_png(const char* filename, struct ppm_pixel* pxs, int w, int h);
+
+// write a QOI file ("Quite OK Image" format, 3 channels)
+// filename: the file to save to
+// pxs: a 1D array of ppm_pixel to save
+// w: the width of the image
+// h: the height of the image
+// returns 0 on success, -1 if the file could not be written
+extern int write_qoi(const char* filename, struct ppm_pixel* pxs, int w, int h);
+
+// write an image, choosing the format from the file extension
+// (.png, .qoi, anything else is written as a binary PPM)
+// filename: the file to save to
+// pxs: a 1D array of ppm_pixel to save
+// w: the width of the image
+// h: the height of the image
+// returns 0 on success, -1 if the file could not be written
+extern int write_image(const char* filename, struct ppm_pixel* pxs, int w, int h);
+
+#endif
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "write_image.h"
+
+// The image is cut into horizontal bands. Each band is filtered and
+// compressed by its own thread into an independent run of deflate blocks
+// that ends on a byte boundary (an empty stored block, like a zlib
+// Z_SYNC_FLUSH), so the bands can simply be concatenated into one zlib
+// stream. The per-band Adler-32 checksums are combined at the end.
+
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 32
+#define MIN_BAND_ROWS 16
+#define ADLER_BASE 65521
+
+struct bit_writer {
+  unsigned char* data;
+  size_t len;
+  size_t cap;
+  uint32_t bits;
+  int count;
+  int failed;
+};
+
+typedef struct {
+  struct ppm_pixel* pxs;
+  int width;
+  int start_row, end_row;
+  struct bit_writer out;
+  uint32_t adler;
+  size_t raw_len;
+} BandData;
+
+static const int len_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int len_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int dist_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const int dist_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void put_byte(struct bit_writer* bw, unsigned char byte) {
+  if (bw->len == bw->cap) {
+    size_t cap = bw->cap ? bw->cap * 2 : 4096;
+    unsigned char* data = realloc(bw->data, cap);
+    if (!data) {
+      bw->failed = 1;
+      return;
+    }
+    bw->data = data;
+    bw->cap = cap;
+  }
+  bw->data[bw->len++] = byte;
+}
+
+// deflate packs bits LSB first
+static void put_bits(struct bit_writer* bw, uint32_t value, int n) {
+  bw->bits |= value << bw->count;
+  bw->count += n;
+  while (bw->count >= 8) {
+    put_byte(bw, bw->bits & 0xff);
+    bw->bits >>= 8;
+    bw->count -= 8;
+  }
+}
+
+// Huffman codes are stored MSB first, so they are reversed before packing
+static void put_code(struct bit_writer* bw, uint32_t code, int n) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < n; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  put_bits(bw, reversed, n);
+}
+
+static void flush_bits(struct bit_writer* bw) {
+  if (bw->count > 0) {
+    put_byte(bw, bw->bits & 0xff);
+  }
+  bw->bits = 0;
+  bw->count = 0;
+}
+
+// fixed Huffman literal/length alphabet (RFC 1951, 3.2.6)
+static void put_literal(struct bit_writer* bw, int lit) {
+  if (lit < 144) put_code(bw, 0x30 + lit, 8);
+  else if (lit < 256) put_code(bw, 0x190 + lit - 144, 9);
+  else if (lit < 280) put_code(bw, lit - 256, 7);
+  else put_code(bw, 0xc0 + lit - 280, 8);
+}
+
+static void put_match(struct bit_writer* bw, int length, int distance) {
+  int code = 28;
+  while (len_base[code] > length) code--;
+  put_literal(bw, 257 + code);
+  put_bits(bw, length - len_base[code], len_extra[code]);
+
+  code = 29;
+  while (dist_base[code] > distance) code--;
+  put_code(bw, code, 5);
+  put_bits(bw, distance - dist_base[code], dist_extra[code]);
+}
+
+static uint32_t hash3(const unsigned char* p) {
+  uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Greedy LZ77 with hash chains, emitted as one fixed-Huffman block and
+// terminated by an empty stored block so the output ends byte aligned.
+static void deflate_band(struct bit_writer* bw, const unsigned char* src, size_t n) {
+  int* head = malloc(HASH_SIZE * sizeof(int));
+  int* prev = malloc(WINDOW_SIZE * sizeof(int));
+  if (!head || !prev) {
+    free(head);
+    free(prev);
+    bw->failed = 1;
+    return;
+  }
+  for (int i = 0; i < HASH_SIZE; i++) head[i] = -1;
+
+  put_bits(bw, 0, 1);  // BFINAL = 0
+  put_bits(bw, 1, 2);  // BTYPE = fixed Huffman
+
+  size_t i = 0;
+  while (i < n) {
+    size_t best_len = 0;
+    size_t best_dist = 0;
+    if (i + MIN_MATCH <= n) {
+      size_t max_len = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+      int cand = head[hash3(src + i)];
+      int chain = MAX_CHAIN;
+      while (cand >= 0 && i - cand <= WINDOW_SIZE && chain-- > 0) {
+        const unsigned char* a = src + cand;
+        const unsigned char* b = src + i;
+        if (a[best_len] == b[best_len]) {
+          size_t l = 0;
+          while (l < max_len && a[l] == b[l]) l++;
+          if (l > best_len) {
+            best_len = l;
+            best_dist = i - cand;
+            if (l == max_len) break;
+          }
+        }
+        cand = prev[cand & (WINDOW_SIZE - 1)];
+      }
+    }
+
+    size_t advance = 1;
+    if (best_len >= MIN_MATCH) {
+      put_match(bw, best_len, best_dist);
+      advance = best_len;
+    } else {
+      put_literal(bw, src[i]);
+    }
+
+    for (size_t end = i + advance; i < end; i++) {
+      if (i + MIN_MATCH <= n) {
+        uint32_t h = hash3(src + i);
+        prev[i & (WINDOW_SIZE - 1)] = head[h];
+        head[h] = i;
+      }
+    }
+  }
+  put_literal(bw, 256);  // end of block
+
+  put_bits(bw, 0, 3);  // BFINAL = 0, BTYPE = stored
+  flush_bits(bw);
+  put_byte(bw, 0x00);
+  put_byte(bw, 0x00);
+  put_byte(bw, 0xff);
+  put_byte(bw, 0xff);
+
+  free(head);
+  free(prev);
+}
+
+static uint32_t adler32(uint32_t adler, const unsigned char* buf, size_t len) {
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (len > 0) {
+    size_t n = len < 5552 ? len : 5552;  // largest n that cannot overflow b
+    len -= n;
+    while (n--) {
+      a += *buf++;
+      b += a;
+    }
+    a %= ADLER_BASE;
+    b %= ADLER_BASE;
+  }
+  return (b << 16) | a;
+}
+
+// checksum of A followed by B, given the checksums of each (as in zlib)
+static uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+  uint32_t rem = len2 % ADLER_BASE;
+  uint32_t sum1 = adler1 & 0xffff;
+  uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+  sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+  sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+  if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+  if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+  if (sum2 >= 2 * ADLER_BASE) sum2 -= 2 * ADLER_BASE;
+  if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+  return (sum2 << 16) | sum1;
+}
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char* buf, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+// Apply the PNG filter (0-4) to one row of RGB bytes
+static void filter_row(int type, const unsigned char* row, const unsigned char* up,
+                       unsigned char* out, int len) {
+  for (int i = 0; i < len; i++) {
+    int a = i >= 3 ? row[i - 3] : 0;
+    int b = up ? up[i] : 0;
+    int c = (up && i >= 3) ? up[i - 3] : 0;
+    int pred = 0;
+    switch (type) {
+      case 1: pred = a; break;
+      case 2: pred = b; break;
+      case 3: pred = (a + b) / 2; break;
+      case 4: pred = paeth(a, b, c); break;
+    }
+    out[i] = row[i] - pred;
+  }
+}
+
+// Filter the band's rows (choosing the filter with the smallest sum of
+// absolute residuals per row), then deflate them.
+static void* compress_band(void* arg) {
+  BandData* data = (BandData*)arg;
+  int stride = data->width * 3;
+  size_t row_len = stride + 1;
+  data->raw_len = row_len * (data->end_row - data->start_row);
+
+  unsigned char* raw = malloc(data->raw_len);
+  unsigned char* trial = malloc(stride);
+  if (!raw || !trial) {
+    free(raw);
+    free(trial);
+    data->out.failed = 1;
+    return NULL;
+  }
+
+  const unsigned char* image = (const unsigned char*)data->pxs;
+  for (int row = data->start_row; row < data->end_row; row++) {
+    const unsigned char* cur = image + (size_t)row * stride;
+    const unsigned char* up = row > 0 ? cur - stride : NULL;
+    unsigned char* out = raw + (size_t)(row - data->start_row) * row_len;
+
+    long best_cost = -1;
+    for (int type = 0; type <= 4; type++) {
+      filter_row(type, cur, up, trial, stride);
+      long cost = 0;
+      for (int i = 0; i < stride; i++) {
+        cost += abs((signed char)trial[i]);
+      }
+      if (best_cost < 0 || cost < best_cost) {
+        best_cost = cost;
+        out[0] = type;
+        memcpy(out + 1, trial, stride);
+      }
+    }
+  }
+
+  data->adler = adler32(1, raw, data->raw_len);
+  deflate_band(&data->out, raw, data->raw_len);
+
+  free(raw);
+  free(trial);
+  return NULL;
+}
+
+static void put_be32(unsigned char* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void write_chunk(FILE* fp, const char* type, const unsigned char* data, size_t len) {
+  unsigned char word[4];
+  put_be32(word, len);
+  fwrite(word, 1, 4, fp);
+  fwrite(type, 1, 4, fp);
+  fwrite(data, 1, len, fp);
+  uint32_t crc = crc32_update(0, (const unsigned char*)type, 4);
+  crc = crc32_update(crc, data, len);
+  put_be32(word, crc);
+  fwrite(word, 1, 4, fp);
+}
+
+int write_png(const char* filename, struct ppm_pixel* pxs, int w, int h) {
+  int numBands = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numBands > h / MIN_BAND_ROWS) numBands = h / MIN_BAND_ROWS;
+  if (numBands < 1) numBands = 1;
+
+  pthread_t* threads = malloc(numBands * sizeof(pthread_t));
+  BandData* bands = calloc(numBands, sizeof(BandData));
+  if (!threads || !bands) {
+    printf("Error: unable to allocate memory\n");
+    free(threads);
+    free(bands);
+    return -1;
+  }
+
+  int rows_per_band = h / numBands;
+  for (int i = 0; i < numBands; i++) {
+    bands[i].pxs = pxs;
+    bands[i].width = w;
+    bands[i].start_row = i * rows_per_band;
+    bands[i].end_row = (i == numBands - 1) ? h : (i + 1) * rows_per_band;
+    pthread_create(&threads[i], NULL, compress_band, &bands[i]);
+  }
+  for (int i = 0; i < numBands; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int result = 0;
+  uint32_t adler = 1;
+  size_t idat_len = 2 + 2 + 4;  // zlib header, final empty block, checksum
+  for (int i = 0; i < numBands; i++) {
+    if (bands[i].out.failed) result = -1;
+    adler = adler32_combine(adler, bands[i].adler, bands[i].raw_len);
+    idat_len += bands[i].out.len;
+  }
+
+  FILE* fp = NULL;
+  if (result == 0) {
+    fp = fopen(filename, "wb");
+    if (!fp) {
+      printf("Error: unable to open file '%s' for writing\n", filename);
+      result = -1;
+    }
+  } else {
+    printf("Error: unable to allocate memory\n");
+  }
+
+  if (fp) {
+    crc_init();
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, sizeof(signature), fp);
+
+    unsigned char ihdr[13];
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = 8;   // bit depth
+    ihdr[9] = 2;   // color type: truecolor
+    ihdr[10] = 0;  // compression: deflate
+    ihdr[11] = 0;  // filter method: adaptive
+    ihdr[12] = 0;  // no interlace
+    write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+    // IDAT is streamed band by band rather than gathered into one buffer
+    unsigned char word[4];
+    put_be32(word, idat_len);
+    fwrite(word, 1, 4, fp);
+    fwrite("IDAT", 1, 4, fp);
+    uint32_t crc = crc32_update(0, (const unsigned char*)"IDAT", 4);
+
+    static const unsigned char zlib_header[2] = {0x78, 0x01};
+    fwrite(zlib_header, 1, 2, fp);
+    crc = crc32_update(crc, zlib_header, 2);
+    for (int i = 0; i < numBands; i++) {
+      fwrite(bands[i].out.data, 1, bands[i].out.len, fp);
+      crc = crc32_update(crc, bands[i].out.data, bands[i].out.len);
+    }
+    static const unsigned char final_block[2] = {0x03, 0x00};  // empty final fixed block
+    fwrite(final_block, 1, 2, fp);
+    crc = crc32_update(crc, final_block, 2);
+    put_be32(word, adler);
+    fwrite(word, 1, 4, fp);
+    crc = crc32_update(crc, word, 4);
+    put_be32(word, crc);
+    fwrite(word, 1, 4, fp);
+
+    write_chunk(fp, "IEND", NULL, 0);
+
+    if (ferror(fp)) {
+      printf("Error: unable to write pixel data to '%s'\n", filename);
+      result = -1;
+    }
+    fclose(fp);
+  }
+
+  for (int i = 0; i < numBands; i++) {
+    free(bands[i].out.data);
+  }
+  free(bands);
+  free(threads);
+  return result;
+}
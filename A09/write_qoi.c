@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "write_image.h"
+
+// QOI op codes (https://qoiformat.org/qoi-specification.pdf)
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_MAX_RUN  62
+
+struct qoi_rgba {
+  unsigned char r, g, b, a;
+};
+
+static unsigned char* put_be32(unsigned char* p, unsigned int v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+  return p + 4;
+}
+
+int write_qoi(const char* filename, struct ppm_pixel* pxs, int w, int h) {
+  size_t npixels = (size_t)w * h;
+  // worst case every pixel needs a 4 byte QOI_OP_RGB
+  unsigned char* out = malloc(14 + npixels * 4 + 8);
+  if (!out) {
+    printf("Error: unable to allocate memory\n");
+    return -1;
+  }
+
+  unsigned char* p = out;
+  memcpy(p, "qoif", 4);
+  p = put_be32(p + 4, w);
+  p = put_be32(p, h);
+  *p++ = 3;  // channels
+  *p++ = 0;  // sRGB with linear alpha
+
+  struct qoi_rgba index[64];
+  memset(index, 0, sizeof(index));
+  struct qoi_rgba prev = {0, 0, 0, 255};
+  int run = 0;
+
+  for (size_t i = 0; i < npixels; i++) {
+    struct qoi_rgba px = {pxs[i].red, pxs[i].green, pxs[i].blue, 255};
+
+    if (px.r == prev.r && px.g == prev.g && px.b == prev.b) {
+      run++;
+      if (run == QOI_MAX_RUN || i == npixels - 1) {
+        *p++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0) {
+      *p++ = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    int slot = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+    if (memcmp(&index[slot], &px, sizeof(px)) == 0) {
+      *p++ = QOI_OP_INDEX | slot;
+    } else {
+      index[slot] = px;
+
+      signed char dr = px.r - prev.r;
+      signed char dg = px.g - prev.g;
+      signed char db = px.b - prev.b;
+      signed char dr_dg = dr - dg;
+      signed char db_dg = db - dg;
+
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        *p++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+        *p++ = QOI_OP_LUMA | (dg + 32);
+        *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+      } else {
+        *p++ = QOI_OP_RGB;
+        *p++ = px.r;
+        *p++ = px.g;
+        *p++ = px.b;
+      }
+    }
+    prev = px;
+  }
+
+  static const unsigned char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  memcpy(p, end_marker, sizeof(end_marker));
+  p += sizeof(end_marker);
+
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    printf("Error: unable to open file '%s' for writing\n", filename);
+    free(out);
+    return -1;
+  }
+  size_t len = p - out;
+  size_t written = fwrite(out, 1, len, fp);
+  fclose(fp);
+  free(out);
+  if (written != len) {
+    printf("Error: unable to write pixel data to '%s'\n", filename);
+    return -1;
+  }
+  return 0;
+}
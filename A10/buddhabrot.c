@@ -7,6 +7,7 @@
 #include <math.h>
 #include "read_ppm.h"
 #include "write_ppm.h"
+#include "async_write.h"
 
 #define MAX_ITER 1000
 
@@ -114,9 +115,10 @@ int main(int argc, char* argv[]) {
     float ymin = -1.12;
     float ymax = 1.12;
     int numThreads = 4;
+    int writeFlags = 0;
 
     int opt;
-    while ((opt = getopt(argc, argv, ":s:l:r:t:b:p:")) != -1) {
+    while ((opt = getopt(argc, argv, ":s:l:r:t:b:p:d")) != -1) {
         switch (opt) {
             case 's': size = atoi(optarg); break;
             case 'l': xmin = atof(optarg); break;
@@ -124,8 +126,9 @@ int main(int argc, char* argv[]) {
             case 't': ymax = atof(optarg); break;
             case 'b': ymin = atof(optarg); break;
             case 'p': numThreads = atoi(optarg); break;
+            case 'd': writeFlags |= ASYNC_WRITE_DIRECT; break;
             case '?': printf("usage: %s -s <size> -l <xmin> -r <xmax> "
-                              "-b <ymin> -t <ymax> -p <numThreads>\n", argv[0]); return 1;
+                              "-b <ymin> -t <ymax> -p <numThreads> [-d]\n", argv[0]); return 1;
         }
     }
 
@@ -196,7 +199,15 @@ int main(int argc, char* argv[]) {
     char filename[100];
     strftime(filename, sizeof(filename), "buddhabrot-%dx%d-%Y%m%d%H%M%S.ppm", time_info);
 
-    write_ppm(filename, image, size, size); 
+    // The image is flushed by a background thread (which then frees it)
+    // while the rest of the cleanup runs
+    struct async_writer* writer = async_writer_start(1, writeFlags);
+    if (writer) {
+        async_write(writer, filename, image, size, size);
+    } else {
+        write_ppm(filename, image, size, size);
+        free(image);
+    }
     printf("Writing file: %s\n", filename); 
     // Cleanup
     for (int i = 0; i < size; i++) { 
@@ -204,10 +215,13 @@ int main(int argc, char* argv[]) {
 	    free(visited_counts[i]);
     } free(membership); 
     free(visited_counts); 
-    free(image); 
     free(threads); 
     free(threadData); 
     pthread_mutex_destroy(&mutex); 
     pthread_barrier_destroy(&barrier); 
+    if (writer && async_writer_finish(writer) != 0) {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        return 1;
+    }
     return 0; 
 }
@@ -1,43 +1,173 @@
+/*----------------------------------------------
+ * Author: Rami Nasr
+ * Date: 10/11/2024
+ * Description: This function reads a PPM (P6) image file in binary format.
+ * It parses the image header (magic number, width, height, and max color value) and then reads the pixel data into a 1D array of struct ppm_pixel.
+ * It returns a pointer to this array for further use.
+ * The header is parsed from a single buffered read instead of fscanf/fgetc
+ * loops; any pixel bytes that arrive with that read are copied directly and
+ * only the remainder is fetched with one more fread.
+ ---------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
 #include "read_ppm.h"
 
-struct ppm_pixel* read_ppm(const char* filename, int* w, int* h) {
-  FILE* fp = fopen(filename, "rb");
-  if (!fp) {
-    printf("Error: unable to open file '%s'\n", filename);
-    return NULL;
-  }
-
-  char format[3];
-  fscanf(fp, "%2s", format);
-  if (strcmp(format, "P6") != 0) {
-    printf("Error: unsupported file format '%s'\n", format);
-    fclose(fp);
-    return NULL;
-  }
-
-  fscanf(fp, "%d %d", w, h);
-  int max_color;
-  fscanf(fp, "%d", &max_color);
-  fgetc(fp); // Consume the newline after max_color
-
-  struct ppm_pixel* pixels = (struct ppm_pixel*)malloc((*w) * (*h) * sizeof(struct ppm_pixel));
-  if (!pixels) {
-    printf("Error: unable to allocate memory\n");
-    fclose(fp);
-    return NULL;
-  }
-
-  size_t read = fread(pixels, sizeof(struct ppm_pixel), (*w) * (*h), fp);
-  if (read != (*w) * (*h)) {
-    printf("Error: unexpected end of file\n");
-    free(pixels);
-    fclose(fp);
-    return NULL;
-  }
-
-  fclose(fp);
-  return pixels;
+// One read normally covers the whole header; longer headers (big comment
+// blocks) grow the buffer up to PPM_HEADER_MAX before giving up.
+#define PPM_HEADER_CHUNK 4096
+#define PPM_HEADER_MAX (1 << 20)
+
+static int is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Skip whitespace and '#' comments (which run to the end of the line).
+// Returns the position of the next token byte, or len if the buffer ran out.
+static size_t skip_space(const unsigned char* buf, size_t len, size_t pos) {
+    while (pos < len) {
+        if (is_space(buf[pos])) {
+            pos++;
+        } else if (buf[pos] == '#') {
+            while (pos < len && buf[pos] != '\n' && buf[pos] != '\r') pos++;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Parse one unsigned decimal field. A number that touches the end of the
+// buffer may continue past it, so that case is reported as truncated.
+static int parse_field(const unsigned char* buf, size_t len, size_t* pos, int* out) {
+    size_t p = skip_space(buf, len, *pos);
+    if (p == len) return PPM_ERR_TRUNCATED;
+    if (buf[p] < '0' || buf[p] > '9') return PPM_ERR_HEADER;
+
+    long value = 0;
+    while (p < len && buf[p] >= '0' && buf[p] <= '9') {
+        value = value * 10 + (buf[p] - '0');
+        if (value > INT_MAX) return PPM_ERR_DIMENSIONS;
+        p++;
+    }
+    if (p == len) return PPM_ERR_TRUNCATED;
+    if (!is_space(buf[p]) && buf[p] != '#') return PPM_ERR_HEADER;
+
+    *out = (int)value;
+    *pos = p;
+    return PPM_OK;
+}
+
+int ppm_parse_header(const unsigned char* buf, size_t len, struct ppm_header* hdr) {
+    if (len < 2) return PPM_ERR_TRUNCATED;
+    if (buf[0] != 'P' || buf[1] != '6') return PPM_ERR_MAGIC;
+
+    size_t pos = 2;
+    int rc;
+    if ((rc = parse_field(buf, len, &pos, &hdr->width)) != PPM_OK) return rc;
+    if ((rc = parse_field(buf, len, &pos, &hdr->height)) != PPM_OK) return rc;
+    if ((rc = parse_field(buf, len, &pos, &hdr->max_val)) != PPM_OK) return rc;
+
+    // Exactly one whitespace byte separates the max value from the raster
+    if (!is_space(buf[pos])) return PPM_ERR_HEADER;
+    hdr->data_offset = pos + 1;
+
+    if (hdr->max_val < 1 || hdr->max_val > 255) return PPM_ERR_MAXVAL;
+
+    // Callers index pixels with int, so width*height must fit in an int as
+    // well as width*height*3 fitting in a size_t.
+    if (hdr->width <= 0 || hdr->height <= 0) return PPM_ERR_DIMENSIONS;
+    if ((size_t)hdr->width > (size_t)INT_MAX / (size_t)hdr->height) return PPM_ERR_DIMENSIONS;
+    if ((size_t)hdr->width * hdr->height > SIZE_MAX / sizeof(struct ppm_pixel)) return PPM_ERR_DIMENSIONS;
+
+    return PPM_OK;
+}
+
+const char* ppm_strerror(int status) {
+    switch (status) {
+        case PPM_OK: return "Success";
+        case PPM_ERR_OPEN: return "Could not open file";
+        case PPM_ERR_MAGIC: return "Invalid PPM format (must start with P6)";
+        case PPM_ERR_HEADER: return "Invalid PPM header";
+        case PPM_ERR_TRUNCATED: return "Unexpected end of file";
+        case PPM_ERR_MAXVAL: return "Max color value must be between 1 and 255";
+        case PPM_ERR_DIMENSIONS: return "Image dimensions are zero or too large";
+        case PPM_ERR_NOMEM: return "Memory allocation failed";
+    }
+    return "Unknown error";
+}
+
+struct ppm_pixel* read_ppm_status(const char* filename, int* width, int* height, int* status) {
+    int rc;
+    struct ppm_pixel* pixels = NULL;
+    unsigned char stack_buf[PPM_HEADER_CHUNK];
+    unsigned char* buf = stack_buf;
+    size_t cap = sizeof(stack_buf);
+
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        rc = PPM_ERR_OPEN;
+        goto done;
+    }
+
+    size_t len = fread(buf, 1, cap, fp);
+    struct ppm_header hdr;
+    while ((rc = ppm_parse_header(buf, len, &hdr)) == PPM_ERR_TRUNCATED
+           && len == cap && cap < PPM_HEADER_MAX) {
+        unsigned char* bigger = (unsigned char*)malloc(cap * 2);
+        if (bigger == NULL) {
+            rc = PPM_ERR_NOMEM;
+            break;
+        }
+        memcpy(bigger, buf, len);
+        if (buf != stack_buf) free(buf);
+        buf = bigger;
+        cap *= 2;
+        len += fread(buf + len, 1, cap - len, fp);
+    }
+    if (rc != PPM_OK) goto done;
+
+    size_t total = (size_t)hdr.width * hdr.height * sizeof(struct ppm_pixel);
+    pixels = (struct ppm_pixel*)malloc(total);
+    if (pixels == NULL) {
+        rc = PPM_ERR_NOMEM;
+        goto done;
+    }
+
+    // Pixel bytes that came in with the header read are already in memory
+    size_t have = len - hdr.data_offset;
+    if (have > total) have = total;
+    memcpy(pixels, buf + hdr.data_offset, have);
+    if (have < total && fread((unsigned char*)pixels + have, 1, total - have, fp) != total - have) {
+        free(pixels);
+        pixels = NULL;
+        rc = PPM_ERR_TRUNCATED;
+        goto done;
+    }
+
+    *width = hdr.width;
+    *height = hdr.height;
+
+done:
+    if (buf != stack_buf) free(buf);
+    if (fp != NULL) fclose(fp);
+    if (status != NULL) *status = rc;
+    return pixels;
+}
+
+struct ppm_pixel* read_ppm(const char* filename, int* width, int* height) {
+    int status;
+    struct ppm_pixel* pixels = read_ppm_status(filename, width, height, &status);
+    if (pixels == NULL) {
+        fprintf(stderr, "Error: %s: %s.\n", filename, ppm_strerror(status));
+    }
+    return pixels;
+}
+
+void free_ppm(struct ppm_pixel* pixels) {
+    if (pixels != NULL) {
+        free(pixels);
+    }
 }
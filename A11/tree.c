@@ -3,6 +3,37 @@
 #include "stdlib.h"
 #include "string.h"  // Added to use strcmp and strncpy
 
+#ifdef USE_SLAB
+#include "../A12/slab.h"
+
+// every node is the same size, so they come from a slab pool (make SLAB=1)
+static struct slab_pool* node_pool = NULL;
+
+static struct tree_node* new_node_memory()
+{
+  if (node_pool == NULL)
+    node_pool = slab_create(sizeof(struct tree_node));
+  if (node_pool == NULL)
+    return NULL;
+  return slab_alloc(node_pool);
+}
+
+static void free_node_memory(struct tree_node* node)
+{
+  slab_free(node_pool, node);
+}
+#else
+static struct tree_node* new_node_memory()
+{
+  return malloc(sizeof(struct tree_node));
+}
+
+static void free_node_memory(struct tree_node* node)
+{
+  free(node);
+}
+#endif
+
 struct tree_node* find(const char* name, struct tree_node* root)
 {
   if (root == NULL)
@@ -20,7 +51,7 @@ struct tree_node* find(const char* name, struct tree_node* root)
 struct tree_node* insert(const char* name, struct tree_node* root)
 {
   if (root == NULL) {
-    struct tree_node* new_node = malloc(sizeof(struct tree_node));
+    struct tree_node* new_node = new_node_memory();
     if (new_node == NULL)
       return NULL;
     strncpy(new_node->data.name, name, sizeof(new_node->data.name));
@@ -43,7 +74,7 @@ void clear(struct tree_node* root)
   if (root != NULL) {
     clear(root->left);
     clear(root->right);
-    free(root);
+    free_node_memory(root);
   }
 }
 
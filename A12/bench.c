@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Runs allocation workloads and reports throughput and memory use.
+// The same source builds bench (this allocator) and bench_glibc (the
+// system malloc), so the two can be compared line by line.
+#ifndef ALLOCATOR
+#define ALLOCATOR "mylloc"
+#endif
+
+#define MAX_THREADS 64
+#define QUEUE 1024
+#define FLUSH 64
+
+// bytes the workload has asked for and not freed yet, and the most at once
+static atomic_long live = 0;
+static atomic_long live_peak = 0;
+
+static int scale = 1;
+
+struct worker {
+  pthread_t thread;
+  int id;
+  unsigned seed;
+  long ops;
+  long delta;    // live bytes not added to the global count yet
+  int pending;
+  struct queue* queue;
+};
+
+// single producer, single consumer ring of blocks to free
+struct queue {
+  void* slots[QUEUE];
+  size_t sizes[QUEUE];
+  atomic_long head;
+  atomic_long tail;
+};
+
+// a recorded trace: one operation per line, "a id size", "r id size" or "f id"
+struct op {
+  char kind;
+  int id;
+  size_t size;
+};
+
+static struct op* trace = NULL;
+static long trace_len = 0;
+static int trace_ids = 0;
+
+static unsigned next_rand(unsigned* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+static void flush_live(struct worker* w) {
+  long now = atomic_fetch_add_explicit(&live, w->delta, memory_order_relaxed) + w->delta;
+  long peak = atomic_load_explicit(&live_peak, memory_order_relaxed);
+  while (now > peak &&
+         !atomic_compare_exchange_weak_explicit(&live_peak, &peak, now,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+  }
+  w->delta = 0;
+  w->pending = 0;
+}
+
+// counts one operation that changed the live bytes by delta
+static void account(struct worker* w, long delta) {
+  w->ops++;
+  w->delta += delta;
+  if (++w->pending == FLUSH) {
+    flush_live(w);
+  }
+}
+
+static void* take(struct worker* w, size_t size) {
+  char* memory = malloc(size);
+  if (memory == NULL) {
+    fprintf(stderr, "malloc(%zu) failed\n", size);
+    exit(1);
+  }
+  memory[0] = (char) size;
+  account(w, size);
+  return memory;
+}
+
+static void give(struct worker* w, void* memory, size_t size) {
+  free(memory);
+  account(w, -(long) size);
+}
+
+// allocates and frees batches of small blocks
+static void* many_small(void* arg) {
+  struct worker* w = arg;
+  void* blocks[1000];
+  size_t sizes[1000];
+  for (int round = 0; round < 200 * scale; round++) {
+    for (int i = 0; i < 1000; i++) {
+      sizes[i] = 16 + next_rand(&w->seed) % 113;
+      blocks[i] = take(w, sizes[i]);
+    }
+    for (int i = 999; i >= 0; i--) {
+      give(w, blocks[i], sizes[i]);
+    }
+  }
+  flush_live(w);
+  return NULL;
+}
+
+// leaves small holes behind, then asks for blocks too big to fit in them
+static void* fragmenting(void* arg) {
+  struct worker* w = arg;
+  void* small[2000];
+  size_t small_sizes[2000];
+  void* large[1000];
+  size_t large_sizes[1000];
+  for (int round = 0; round < 20 * scale; round++) {
+    for (int i = 0; i < 2000; i++) {
+      small_sizes[i] = 16 + next_rand(&w->seed) % 497;
+      small[i] = take(w, small_sizes[i]);
+    }
+    for (int i = 1; i < 2000; i += 2) {
+      give(w, small[i], small_sizes[i]);
+    }
+    for (int i = 0; i < 1000; i++) {
+      large_sizes[i] = 600 + next_rand(&w->seed) % 1401;
+      large[i] = take(w, large_sizes[i]);
+    }
+    for (int i = 0; i < 2000; i += 2) {
+      give(w, small[i], small_sizes[i]);
+    }
+    for (int i = 0; i < 1000; i++) {
+      give(w, large[i], large_sizes[i]);
+    }
+  }
+  flush_live(w);
+  return NULL;
+}
+
+// even workers allocate blocks and pass them to the next worker, which frees them
+static void* producer_consumer(void* arg) {
+  struct worker* w = arg;
+  struct queue* q = w->queue;
+  long count = 100000L * scale;
+  if (w->id % 2 == 0) {
+    for (long i = 0; i < count; i++) {
+      long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+      while (head - atomic_load_explicit(&q->tail, memory_order_acquire) == QUEUE) {
+        sched_yield();
+      }
+      size_t size = 16 + next_rand(&w->seed) % 1009;
+      q->sizes[head % QUEUE] = size;
+      q->slots[head % QUEUE] = take(w, size);
+      atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    }
+  } else {
+    for (long i = 0; i < count; i++) {
+      long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+      while (atomic_load_explicit(&q->head, memory_order_acquire) == tail) {
+        sched_yield();
+      }
+      give(w, q->slots[tail % QUEUE], q->sizes[tail % QUEUE]);
+      atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    }
+  }
+  flush_live(w);
+  return NULL;
+}
+
+static void* replay(void* arg) {
+  struct worker* w = arg;
+  void** blocks = calloc(trace_ids, sizeof(void*));
+  size_t* sizes = calloc(trace_ids, sizeof(size_t));
+  for (long i = 0; i < trace_len; i++) {
+    struct op* op = &trace[i];
+    if (op->kind == 'a') {
+      blocks[op->id] = take(w, op->size);
+      sizes[op->id] = op->size;
+    } else if (op->kind == 'r') {
+      char* moved = realloc(blocks[op->id], op->size);
+      if (moved == NULL) {
+        fprintf(stderr, "realloc(%zu) failed\n", op->size);
+        exit(1);
+      }
+      blocks[op->id] = moved;
+      account(w, (long) op->size - (long) sizes[op->id]);
+      sizes[op->id] = op->size;
+    } else if (blocks[op->id] != NULL) {
+      give(w, blocks[op->id], sizes[op->id]);
+      blocks[op->id] = NULL;
+    }
+  }
+  // whatever the trace left allocated is released outside the count
+  for (int id = 0; id < trace_ids; id++) {
+    free(blocks[id]);
+  }
+  free(blocks);
+  free(sizes);
+  flush_live(w);
+  return NULL;
+}
+
+static int load_trace(const char* filename) {
+  FILE* infile = fopen(filename, "r");
+  if (infile == NULL) {
+    printf("Cannot open trace %s\n", filename);
+    return -1;
+  }
+  long capacity = 1024;
+  trace = malloc(capacity * sizeof(struct op));
+  trace_len = 0;
+  trace_ids = 0;
+  char line[128];
+  while (fgets(line, sizeof(line), infile) != NULL) {
+    struct op op = {0};
+    if (sscanf(line, " %c %d %zu", &op.kind, &op.id, &op.size) < 2 ||
+        (op.kind != 'a' && op.kind != 'r' && op.kind != 'f') || op.id < 0) {
+      continue;
+    }
+    if (op.kind != 'f' && op.size == 0) {
+      continue;
+    }
+    if (trace_len == capacity) {
+      capacity *= 2;
+      trace = realloc(trace, capacity * sizeof(struct op));
+    }
+    trace[trace_len++] = op;
+    if (op.id >= trace_ids) {
+      trace_ids = op.id + 1;
+    }
+  }
+  fclose(infile);
+  return 0;
+}
+
+static long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// runs one workload in a child process, so every run starts from a fresh
+// heap and the peak memory belongs to that run alone; peak is resident
+// memory, so pages the workload never touches do not count
+static void run(const char* name, void* (*workload)(void*), int threads) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return;
+  }
+  if (pid > 0) {
+    waitpid(pid, NULL, 0);
+    return;
+  }
+
+  struct worker workers[MAX_THREADS];
+  struct queue queues[MAX_THREADS / 2];
+  memset(workers, 0, sizeof(workers));
+  memset(queues, 0, sizeof(queues));
+  long baseline = peak_rss_kb();
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < threads; i++) {
+    workers[i].id = i;
+    workers[i].seed = 1 + i;
+    workers[i].queue = &queues[i / 2];
+    pthread_create(&workers[i].thread, NULL, workload, &workers[i]);
+  }
+  long ops = 0;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    ops += workers[i].ops;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1.e9;
+  long peak = peak_rss_kb() - baseline;
+  long live_kb = atomic_load(&live_peak) / 1024;
+  printf("%-7s %-18s %2d threads %12.0f ops/s  peak %8ld KB  live %8ld KB  overhead %5.2f\n",
+         ALLOCATOR, name, threads, ops / seconds, peak, live_kb,
+         live_kb > 0 ? (double) peak / live_kb : 0.0);
+  fflush(stdout);
+  exit(0);
+}
+
+int main(int argc, char* argv[]) {
+  int thread_counts[MAX_THREADS];
+  int num_counts = 0;
+  const char* only = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, ":t:n:w:")) != -1) {
+    switch (opt) {
+      case 't': {
+        char* list = optarg;
+        char* token;
+        while ((token = strtok(list, ",")) != NULL && num_counts < MAX_THREADS) {
+          list = NULL;
+          int count = atoi(token);
+          if (count >= 1 && count <= MAX_THREADS) {
+            thread_counts[num_counts++] = count;
+          }
+        }
+        break;
+      }
+      case 'n': scale = atoi(optarg); break;
+      case 'w': only = optarg; break;
+      case '?': printf("usage: %s [-t threads,...] [-n scale] [-w workload] [traces...]\n", argv[0]);
+                return 1;
+    }
+  }
+  if (num_counts == 0) {
+    int defaults[] = {1, 2, 4, 8};
+    for (int i = 0; i < 4; i++) {
+      thread_counts[num_counts++] = defaults[i];
+    }
+  }
+  if (scale < 1) {
+    scale = 1;
+  }
+
+  struct {
+    const char* name;
+    void* (*run)(void*);
+  } workloads[] = {
+    {"many-small", many_small},
+    {"fragmenting", fragmenting},
+    {"producer-consumer", producer_consumer},
+  };
+
+  for (int i = 0; i < 3; i++) {
+    if (only != NULL && strcmp(only, workloads[i].name) != 0) {
+      continue;
+    }
+    int last = 0;
+    for (int j = 0; j < num_counts; j++) {
+      int threads = thread_counts[j];
+      // producers and consumers come in pairs
+      if (workloads[i].run == producer_consumer) {
+        threads = threads < 2 ? 2 : threads & ~1;
+      }
+      if (threads != last) {
+        run(workloads[i].name, workloads[i].run, threads);
+      }
+      last = threads;
+    }
+  }
+
+  // traces are replayed by a single thread, as they were recorded
+  for (int i = optind; i < argc; i++) {
+    if (load_trace(argv[i]) == 0) {
+      const char* name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+      run(name, replay, 1);
+      free(trace);
+      trace = NULL;
+    }
+  }
+  return 0;
+}
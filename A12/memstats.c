@@ -5,82 +5,40 @@
 #include <time.h>
 #include <string.h>
 #include "rand.h"
+#include "mylloc.h"
 
 #define ROUNDS 3
 #define BUFFER 5
 #define LOOP 10
 
-struct chunk {
-  int size;
-  int used;
-  struct chunk *next;
-};
-
-void memstats(struct chunk* freelist, void* buffer[], int len) {
-    int total_blocks = 0;
-    int free_blocks = 0;
-    int used_blocks = 0;
-    int total_memory_allocated = 0;
-    int total_memory_free = 0;
-    int total_memory_used = 0;
-
-    struct chunk* current = freelist;
-    while (current != NULL) {
-        total_blocks++;
-        total_memory_allocated += current->size;
-        
-        if (current->used == 0) {
-            free_blocks++;
-            total_memory_free += current->size;
-        } else {
-            used_blocks++;
-            total_memory_used += current->used;
-        }
-        
-        current = current->next;
-    }
+// prints the allocator's counters; cheap enough to call as often as we like
+void memstats() {
+    struct mylloc_stats stats;
+    mylloc_stats(&stats);
 
-    // Count used blocks in the buffer
-    for (int i = 0; i < len; i++) {
-        if (buffer[i] != NULL) {
-            // Get the chunk header
-            struct chunk* chunk = ((struct chunk*)buffer[i]) - 1;
-            
-            // If this block is not in the free list, count it
-            int found_in_freelist = 0;
-            current = freelist;
-            while (current != NULL) {
-                if (current == chunk) {
-                    found_in_freelist = 1;
-                    break;
-                }
-                current = current->next;
-            }
-            
-            if (!found_in_freelist) {
-                total_blocks++;
-                total_memory_allocated += chunk->size;
-                
-                if (chunk->used > 0) {
-                    used_blocks++;
-                    total_memory_used += chunk->used;
-                } else {
-                    free_blocks++;
-                    total_memory_free += chunk->size;
-                }
-            }
+    for (int class = 0; class < MYLLOC_HISTOGRAM; class++) {
+        if (stats.histogram[class] > 0) {
+            printf("  %8zu+ bytes: %zu in use\n", class == 0 ? (size_t) 1 : (size_t) 8 << class,
+                   stats.histogram[class]);
         }
     }
+    if (mylloc_tree_searches > 0) {
+        printf("  tree searches: %lu, average depth %.2f, max depth %d\n", mylloc_tree_searches,
+               (double) mylloc_tree_steps / mylloc_tree_searches, mylloc_tree_max_depth);
+    }
+
+    size_t total_memory_allocated = stats.heap + stats.mapped;
+    size_t total_memory_free = stats.free + stats.cached;
 
     // Calculate underutilized memory percentage
-    double underutilized_percent = total_memory_allocated > 0 
-        ? (double)(total_memory_allocated - total_memory_used) / total_memory_allocated 
+    double underutilized_percent = total_memory_allocated > 0
+        ? (double)(total_memory_allocated - stats.in_use) / total_memory_allocated
         : 0.0;
 
-    printf("Total blocks: %d Free blocks: %d Used blocks: %d\n", 
-           total_blocks, free_blocks, used_blocks);
-    printf("Total memory allocated: %d Free memory: %d Used memory: %d\n", 
-           total_memory_allocated, total_memory_free, total_memory_used);
+    printf("Total blocks: %zu Free blocks: %zu Used blocks: %zu\n",
+           stats.free_blocks + stats.in_use_blocks, stats.free_blocks, stats.in_use_blocks);
+    printf("Total memory allocated: %zu Free memory: %zu Used memory: %zu Peak used: %zu\n",
+           total_memory_allocated, total_memory_free, stats.in_use, stats.peak_in_use);
     printf("Underutilized memory: %.2f\n", underutilized_percent);
 }
 
@@ -127,14 +85,13 @@ int main ( int argc, char* argv[]) {
         printf("Allocating %d bytes at index %d\n", (int) size, index);
       }
     }
-    extern struct chunk* flist;
     current = sbrk(0);
     int allocated = current - init;
     init = current;
 
     printf("The new top of the heap is %p.\n", current);
     printf("Increased by %d (0x%x) bytes\n", allocated, allocated);
-    memstats(flist, buffer, BUFFER);
+    memstats();
   }
 
   for (int i = 0; i < BUFFER; i++) {
@@ -0,0 +1,152 @@
+#ifndef MYLLOC_H_
+#define MYLLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every chunk starts with a one-word header holding its size, counting the
+// header, and flags in the low bits the size leaves free. Chunks sit back to
+// back in the heap, so the chunk above c starts size bytes after it. The data
+// of a chunk in use starts after the header, aligned to MYLLOC_ALIGN, and runs
+// on into the first word of the chunk above, its prev_size. A free chunk has
+// no data there, so it keeps its size in that word instead (the footer), which
+// is how the chunk above finds the one below it to merge with.
+struct chunk {
+  size_t prev_size;  // size of the chunk below, only while MYLLOC_PREV_INUSE is clear
+  size_t head;       // size | flags
+};
+
+#define MYLLOC_INUSE 1       // handed out, or kept in a thread cache
+#define MYLLOC_PREV_INUSE 2  // the chunk below is in use, or there is none
+#define MYLLOC_MMAPPED 4     // the chunk has a mapping of its own outside the heap
+#define MYLLOC_FLAGS (MYLLOC_INUSE | MYLLOC_PREV_INUSE | MYLLOC_MMAPPED)
+#define MYLLOC_SIZE(c) ((c)->head & ~(size_t) MYLLOC_FLAGS)
+
+// Free chunks are linked into their bin through the first bytes of their data.
+struct free_links {
+  struct chunk *next;
+  struct chunk *prev;
+};
+#define MYLLOC_LINKS(c) ((struct free_links*) ((c) + 1))
+
+// Larger free chunks are kept in a tree ordered by size through these links.
+struct tree_links {
+  struct chunk *left;
+  struct chunk *right;
+};
+#define MYLLOC_TREE(c) ((struct tree_links*) ((c) + 1))
+
+// Chunk sizes are multiples of MYLLOC_ALIGN, at least two of them so a free
+// chunk has room for its links. Free chunks up to MYLLOC_SMALL_MAX bytes are
+// kept in bins that hold exactly one size each (32, 48, ..., MYLLOC_SMALL_MAX
+// bytes); bigger ones go in the tree, which finds the best fit in O(log n).
+#define MYLLOC_ALIGN 16
+#define MYLLOC_SMALL_MAX 512
+#define MYLLOC_SMALL_BINS (MYLLOC_SMALL_MAX / MYLLOC_ALIGN)
+
+// Requests of at least MYLLOC_MMAP_THRESHOLD bytes get their own mmap, which
+// is unmapped on free. When the free chunk at the top of the heap grows past
+// MYLLOC_TRIM_THRESHOLD bytes, the heap is shrunk and the pages go back.
+#define MYLLOC_MMAP_THRESHOLD (128 * 1024)
+#define MYLLOC_TRIM_THRESHOLD (128 * 1024)
+
+// Small chunks (up to MYLLOC_TCACHE_MAX bytes) are cached per thread: each
+// thread keeps up to mylloc_tcache_count chunks of each size and moves them
+// to and from the locked central heap MYLLOC_TCACHE_BATCH at a time.
+// Setting mylloc_tcache_count to 0 sends every call to the central heap.
+#define MYLLOC_TCACHE_MAX 256
+#define MYLLOC_TCACHE_BINS (MYLLOC_TCACHE_MAX / MYLLOC_ALIGN)
+#define MYLLOC_TCACHE_COUNT 32
+#define MYLLOC_TCACHE_BATCH 8
+
+extern int mylloc_tcache_count;
+
+// heads of the free lists, one per bin
+extern struct chunk *bins[MYLLOC_SMALL_BINS];
+
+// bit i is set when bins[i] is non-empty
+extern unsigned long long binmap;
+
+// root of the tree of large free chunks
+extern struct chunk *mylloc_tree;
+
+// number of best-fit searches in the tree, the nodes they visited in
+// total, and the most visited by one search
+extern unsigned long mylloc_tree_searches;
+extern unsigned long mylloc_tree_steps;
+extern int mylloc_tree_max_depth;
+
+// returns the bin that holds free chunks of the given size,
+// or MYLLOC_SMALL_BINS if they go in the tree
+extern int mylloc_bin(size_t size);
+
+// chunk size held by a bin
+extern size_t mylloc_bin_size(int bin);
+
+// Counters kept up to date by every call, so reading them costs the same
+// no matter how big the heap is. Byte counts for blocks in use are what
+// malloc_usable_size reports for them; heap, mapped, free and cached are
+// chunk sizes.
+#define MYLLOC_HISTOGRAM 24
+
+struct mylloc_stats {
+  size_t heap;           // bytes between the start of the heap and the break
+  size_t mapped;         // bytes in chunks with a mapping of their own
+  size_t in_use;         // usable bytes in blocks not freed yet
+  size_t in_use_blocks;
+  size_t peak_in_use;    // the most in_use has been when a thread went to the central heap
+  size_t free;           // bytes in free chunks in the bins and the tree
+  size_t free_blocks;
+  size_t cached;         // bytes freed into thread caches
+  size_t histogram[MYLLOC_HISTOGRAM];  // blocks in use per mylloc_size_class
+};
+
+// fills stats with the current counters
+extern void mylloc_stats(struct mylloc_stats *stats);
+
+// histogram slot for a block of size bytes: 0 for under 16 bytes,
+// then one slot per power of two, the last one holding everything bigger
+extern int mylloc_size_class(size_t size);
+
+// Walks every chunk in the heap and every free list, printing each problem
+// it finds to stderr: chunks that overlap or run past the top of the heap,
+// boundary tags that do not match, free chunks next to each other, and free
+// lists that hold chunks in use or hold a chunk twice, as freeing a block
+// twice does. The calling thread's cache is checked too, but not those of
+// other threads or mapped chunks. Returns the number of problems.
+extern int mylloc_check(void);
+
+// Setting MYLLOC_TRACE=file in the environment records every allocation and
+// free into file (and a copy of /proc/self/maps into file.maps). A %p in the
+// name becomes the process id, so programs it starts get traces too. Each thread
+// fills a buffer of its own, which is appended to the file whenever it fills
+// up, when the thread exits, and when the process exits (records still in a
+// buffer when the process calls exec are lost). tracestat summarizes a trace.
+#define MYLLOC_TRACE_MAGIC "MYLLOCT1"
+#define MYLLOC_TRACE_RECORDS 2048
+#define MYLLOC_TRACE_ALLOC 'a'
+#define MYLLOC_TRACE_FREE 'f'
+
+struct mylloc_trace_record {
+  uint64_t time;      // nanoseconds, CLOCK_MONOTONIC
+  uint64_t address;   // block handed out or freed
+  uint64_t caller;    // return address into the code that called the allocator
+  uint32_t size;      // bytes requested, 0 for a free
+  uint16_t thread;    // small number given to each thread that allocates
+  uint8_t op;         // MYLLOC_TRACE_ALLOC or MYLLOC_TRACE_FREE
+  uint8_t pad;
+};
+
+// non-zero while a trace is being recorded
+extern int mylloc_tracing;
+
+// opens the trace if MYLLOC_TRACE is set
+extern void mylloc_trace_start(void);
+
+// adds a record to the calling thread's buffer
+extern void mylloc_trace(int op, void *address, size_t size, void *caller);
+
+// stops tracing in a forked child, dropping records copied from the parent
+extern void mylloc_trace_fork_child(void);
+
+#endif
@@ -1,57 +1,1210 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "mylloc.h"
 
-struct chunk {
-  int size;
-  int used;
-  struct chunk *next;
+#define WORD sizeof(size_t)
+#define MIN_CHUNK (2 * (size_t) MYLLOC_ALIGN)
+
+// larger requests could overflow the size arithmetic, and could never be met
+#define MAX_REQUEST ((size_t) PTRDIFF_MAX / 2)
+
+// Debug builds (make debug) look for programs misusing the heap. Each block
+// gets DEBUG_SPACE extra bytes: the bytes past the size asked for are filled
+// with CANARY, and its last word holds that size, or FREED once the block is
+// freed, so free and realloc catch writes past the end and blocks freed twice.
+// Mapped chunks end right below a guard page, so running off the end of one
+// faults at once.
+#ifdef MYLLOC_DEBUG
+#define DEBUG_SPACE (2 * WORD)
+#define GUARD_PAGES 1
+#define CANARY 0xfd
+#define FREED ((size_t) 0xf4eef4eef4eef4eeULL)
+#else
+#define DEBUG_SPACE 0
+#define GUARD_PAGES 0
+#endif
+
+struct chunk *bins[MYLLOC_SMALL_BINS];
+unsigned long long binmap = 0;
+
+struct chunk *mylloc_tree = NULL;
+unsigned long mylloc_tree_searches = 0;
+unsigned long mylloc_tree_steps = 0;
+int mylloc_tree_max_depth = 0;
+
+// the highest chunk in the heap; nothing follows it until sbrk grows the heap
+static struct chunk *top = NULL;
+
+// the lowest chunk in the heap, where mylloc_check starts
+static struct chunk *bottom = NULL;
+
+// guards the bins, top and sbrk; the thread caches below need no lock
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Counters for mylloc_stats that change under heap_lock
+static size_t heap_bytes = 0;
+static size_t free_bytes = 0;
+static size_t free_blocks = 0;
+static size_t peak_in_use = 0;
+static atomic_size_t mapped_bytes = 0;
+
+// Counters each thread keeps for the blocks it hands out and takes back.
+// Only the owner writes them, so no atomic read-modify-write is needed;
+// mylloc_stats adds them up over all threads.
+struct counts {
+  atomic_long in_use;
+  atomic_long in_use_blocks;
+  atomic_long cached;
+  atomic_long histogram[MYLLOC_HISTOGRAM];
 };
 
-struct chunk *flist = NULL;
+// Each thread keeps a few free chunks of every small size for itself, linked
+// through MYLLOC_LINKS(c)->next. To the central heap these chunks are in use.
+struct tcache {
+  struct chunk *list[MYLLOC_TCACHE_BINS];
+  int count[MYLLOC_TCACHE_BINS];
+  int registered;
+  int exited;           // the cache was handed back; the thread is going away
+  struct tcache *next;  // every registered thread, guarded by heap_lock
+  struct counts counts;
+};
+
+// initial-exec keeps the first access in a thread from calling into malloc
+static __thread struct tcache tcache __attribute__((tls_model("initial-exec")));
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static struct tcache *threads = NULL;
+
+// counts left behind by threads that have exited; updated with atomic adds,
+// since a thread that is going away may still free blocks without the lock
+static struct counts retired;
+
+int mylloc_tcache_count = MYLLOC_TCACHE_COUNT;
+
+int mylloc_size_class(size_t size) {
+  int class = 63 - __builtin_clzll(size | 1) - 3;
+  return class < 0 ? 0 : class >= MYLLOC_HISTOGRAM ? MYLLOC_HISTOGRAM - 1 : class;
+}
+
+static void bump(atomic_long *counter, long delta) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + delta,
+                        memory_order_relaxed);
+}
+
+static long read_counter(atomic_long *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// adds delta to one of counts, which only the calling thread writes unless
+// it is retired
+static void add(struct counts *counts, atomic_long *counter, long delta) {
+  if (counts == &retired) {
+    atomic_fetch_add_explicit(counter, delta, memory_order_relaxed);
+  } else {
+    bump(counter, delta);
+  }
+}
+
+// adds every counter in from to to, and clears from
+static void move_counts(struct counts *to, struct counts *from) {
+  atomic_fetch_add_explicit(&to->in_use, read_counter(&from->in_use), memory_order_relaxed);
+  atomic_fetch_add_explicit(&to->in_use_blocks, read_counter(&from->in_use_blocks), memory_order_relaxed);
+  atomic_fetch_add_explicit(&to->cached, read_counter(&from->cached), memory_order_relaxed);
+  for (int class = 0; class < MYLLOC_HISTOGRAM; class++) {
+    atomic_fetch_add_explicit(&to->histogram[class], read_counter(&from->histogram[class]),
+                              memory_order_relaxed);
+  }
+  memset(from, 0, sizeof(*from));
+}
+
+static void tcache_release(void *arg);
+
+static void tcache_init(void) {
+  pthread_key_create(&tcache_key, tcache_release);
+}
+
+// adds the calling thread to the list mylloc_stats reads, and makes sure its
+// cache and counts are handed back when it exits
+static void thread_register(void) {
+  pthread_once(&tcache_once, tcache_init);
+  pthread_setspecific(tcache_key, &tcache);
+  pthread_mutex_lock(&heap_lock);
+  tcache.next = threads;
+  threads = &tcache;
+  tcache.registered = 1;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+// The C library still frees blocks in a thread after its key destructors
+// have run; registering again then would leave the thread on the list after
+// it is gone, so those blocks are counted as retired instead.
+static struct counts *thread_counts(void) {
+  if (!tcache.registered) {
+    if (tcache.exited) {
+      return &retired;
+    }
+    thread_register();
+  }
+  return &tcache.counts;
+}
+
+// a block of size bytes was handed out
+static void count_alloc(size_t size) {
+  struct counts *counts = thread_counts();
+  add(counts, &counts->in_use, size);
+  add(counts, &counts->in_use_blocks, 1);
+  add(counts, &counts->histogram[mylloc_size_class(size)], 1);
+}
+
+// a block of size bytes was given back
+static void count_free(size_t size) {
+  struct counts *counts = thread_counts();
+  add(counts, &counts->in_use, -(long) size);
+  add(counts, &counts->in_use_blocks, -1);
+  add(counts, &counts->histogram[mylloc_size_class(size)], -1);
+}
+
+static void count_cached(long delta) {
+  struct counts *counts = thread_counts();
+  add(counts, &counts->cached, delta);
+}
+
+// bytes in use right now; the caller holds heap_lock
+static long total_in_use(void) {
+  long total = read_counter(&retired.in_use);
+  for (struct tcache *thread = threads; thread != NULL; thread = thread->next) {
+    total += read_counter(&thread->counts.in_use);
+  }
+  return total;
+}
+
+// Finding the exact high-water mark would mean sharing one counter between
+// all threads, so it is checked whenever a thread comes to the central heap
+// instead, which it has to do for the heap to grow.
+static void sample_peak(void) {
+  long now = total_in_use();
+  if (now > (long) peak_in_use) {
+    peak_in_use = now;
+  }
+}
+
+// A child process starts with only the thread that called fork, so the lock
+// must not be held by some other thread at that moment.
+static void fork_prepare(void) {
+  pthread_mutex_lock(&heap_lock);
+}
+
+static void fork_parent(void) {
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void fork_child(void) {
+  pthread_mutex_init(&heap_lock, NULL);
+  // the other threads are gone, but the blocks they counted are still here
+  for (struct tcache *thread = threads; thread != NULL; thread = thread->next) {
+    if (thread != &tcache) {
+      move_counts(&retired, &thread->counts);
+    }
+  }
+  threads = tcache.registered ? &tcache : NULL;
+  tcache.next = NULL;
+  mylloc_trace_fork_child();
+}
+
+static void __attribute__((constructor)) mylloc_init(void) {
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  mylloc_trace_start();
+}
+
+int mylloc_bin(size_t size) {
+  if (size <= MYLLOC_SMALL_MAX) {
+    return (size + MYLLOC_ALIGN - 1) / MYLLOC_ALIGN - 1;
+  }
+  return MYLLOC_SMALL_BINS;
+}
+
+size_t mylloc_bin_size(int bin) {
+  return (size_t) (bin + 1) * MYLLOC_ALIGN;
+}
+
+static size_t chunk_size(struct chunk *c) {
+  return MYLLOC_SIZE(c);
+}
+
+static int in_use(struct chunk *c) {
+  return (c->head & MYLLOC_INUSE) != 0;
+}
+
+// changes the size of c and keeps its flags
+static void set_size(struct chunk *c, size_t size) {
+  c->head = size | (c->head & MYLLOC_FLAGS);
+}
+
+// the chunk size that holds size bytes of data: the header word, plus the
+// data less the word it borrows from the chunk above
+static size_t request_size(size_t size) {
+  size_t asize = (size + WORD + MYLLOC_ALIGN - 1) & ~((size_t) MYLLOC_ALIGN - 1);
+  return asize < MIN_CHUNK ? MIN_CHUNK : asize;
+}
+
+// bytes of data a chunk in use holds; a mapped chunk has no chunk above it
+static size_t usable(struct chunk *c) {
+  return chunk_size(c) - ((c->head & MYLLOC_MMAPPED) ? 2 * WORD : WORD);
+}
+
+static struct chunk *next_chunk(struct chunk *c) {
+  return (struct chunk*) ((char*) c + chunk_size(c));
+}
+
+// only valid while the chunk below c is free
+static struct chunk *prev_chunk(struct chunk *c) {
+  return (struct chunk*) ((char*) c - c->prev_size);
+}
+
+// The tree is a treap: ordered by (size, address) like a binary search
+// tree, and a heap on a priority hashed from the address, which keeps it
+// balanced on average without storing anything besides the two children.
+static unsigned priority(struct chunk *c) {
+  return (unsigned) ((((uintptr_t) c >> 4) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static int tree_less(struct chunk *a, struct chunk *b) {
+  return chunk_size(a) < chunk_size(b) || (chunk_size(a) == chunk_size(b) && a < b);
+}
+
+static struct chunk *tree_insert(struct chunk *root, struct chunk *c) {
+  if (root == NULL) {
+    MYLLOC_TREE(c)->left = NULL;
+    MYLLOC_TREE(c)->right = NULL;
+    return c;
+  }
+  if (tree_less(c, root)) {
+    struct chunk *left = tree_insert(MYLLOC_TREE(root)->left, c);
+    if (priority(left) > priority(root)) {
+      // rotate right
+      MYLLOC_TREE(root)->left = MYLLOC_TREE(left)->right;
+      MYLLOC_TREE(left)->right = root;
+      return left;
+    }
+    MYLLOC_TREE(root)->left = left;
+  } else {
+    struct chunk *right = tree_insert(MYLLOC_TREE(root)->right, c);
+    if (priority(right) > priority(root)) {
+      // rotate left
+      MYLLOC_TREE(root)->right = MYLLOC_TREE(right)->left;
+      MYLLOC_TREE(right)->left = root;
+      return right;
+    }
+    MYLLOC_TREE(root)->right = right;
+  }
+  return root;
+}
+
+// joins two treaps where every key in a is below every key in b
+static struct chunk *tree_merge(struct chunk *a, struct chunk *b) {
+  if (a == NULL) return b;
+  if (b == NULL) return a;
+  if (priority(a) > priority(b)) {
+    MYLLOC_TREE(a)->right = tree_merge(MYLLOC_TREE(a)->right, b);
+    return a;
+  }
+  MYLLOC_TREE(b)->left = tree_merge(a, MYLLOC_TREE(b)->left);
+  return b;
+}
+
+static struct chunk *tree_remove(struct chunk *root, struct chunk *c) {
+  if (root == c) {
+    return tree_merge(MYLLOC_TREE(c)->left, MYLLOC_TREE(c)->right);
+  }
+  if (tree_less(c, root)) {
+    MYLLOC_TREE(root)->left = tree_remove(MYLLOC_TREE(root)->left, c);
+  } else {
+    MYLLOC_TREE(root)->right = tree_remove(MYLLOC_TREE(root)->right, c);
+  }
+  return root;
+}
+
+// returns the smallest free chunk in the tree with at least size bytes
+static struct chunk *tree_best_fit(size_t size) {
+  struct chunk *best = NULL;
+  int depth = 0;
+  for (struct chunk *node = mylloc_tree; node != NULL; depth++) {
+    if (chunk_size(node) >= size) {
+      best = node;
+      node = MYLLOC_TREE(node)->left;
+    } else {
+      node = MYLLOC_TREE(node)->right;
+    }
+  }
+  mylloc_tree_searches++;
+  mylloc_tree_steps += depth;
+  if (depth > mylloc_tree_max_depth) {
+    mylloc_tree_max_depth = depth;
+  }
+  return best;
+}
+
+static void bin_insert(struct chunk *c) {
+  free_bytes += chunk_size(c);
+  free_blocks++;
+  if (chunk_size(c) > MYLLOC_SMALL_MAX) {
+    mylloc_tree = tree_insert(mylloc_tree, c);
+    return;
+  }
+  int bin = mylloc_bin(chunk_size(c));
+  MYLLOC_LINKS(c)->prev = NULL;
+  MYLLOC_LINKS(c)->next = bins[bin];
+  if (bins[bin] != NULL) {
+    MYLLOC_LINKS(bins[bin])->prev = c;
+  }
+  bins[bin] = c;
+  binmap |= 1ULL << bin;
+}
+
+static void bin_remove(struct chunk *c) {
+  free_bytes -= chunk_size(c);
+  free_blocks--;
+  if (chunk_size(c) > MYLLOC_SMALL_MAX) {
+    mylloc_tree = tree_remove(mylloc_tree, c);
+    return;
+  }
+  int bin = mylloc_bin(chunk_size(c));
+  struct chunk *next = MYLLOC_LINKS(c)->next;
+  struct chunk *prev = MYLLOC_LINKS(c)->prev;
+  if (prev != NULL) {
+    MYLLOC_LINKS(prev)->next = next;
+  } else {
+    bins[bin] = next;
+    if (next == NULL) {
+      binmap &= ~(1ULL << bin);
+    }
+  }
+  if (next != NULL) {
+    MYLLOC_LINKS(next)->prev = prev;
+  }
+}
+
+// tell the chunk above c whether c is in use, and if not, how big it is
+static void set_tag(struct chunk *c) {
+  if (c == top) {
+    return;
+  }
+  struct chunk *next = next_chunk(c);
+  if (in_use(c)) {
+    next->head |= MYLLOC_PREV_INUSE;
+  } else {
+    next->head &= ~(size_t) MYLLOC_PREV_INUSE;
+    next->prev_size = chunk_size(c);
+  }
+}
+
+// cut the free chunk c down to size bytes if the rest is big enough to be a
+// chunk of its own; c is about to be handed out
+static void split(struct chunk *c, size_t size) {
+  if (chunk_size(c) - size < MIN_CHUNK) {
+    return;
+  }
+  struct chunk *rest = (struct chunk*) ((char*) c + size);
+  rest->head = (chunk_size(c) - size) | MYLLOC_PREV_INUSE;
+  set_size(c, size);
+  if (c == top) {
+    top = rest;
+  }
+  set_tag(rest);
+  bin_insert(rest);
+}
+
+// moves the break and keeps heap_bytes up to date
+static void *grow_heap(intptr_t size) {
+  void *old = sbrk(size);
+  if (old != (void*) -1) {
+    heap_bytes += size;
+  }
+  return old;
+}
+
+// The data of the top chunk runs on into the word after it, so the break
+// stays one word past the end of the top chunk. Before the first chunk, this
+// moves the break there, so that chunk starts on an aligned address.
+static int start_heap(void) {
+  uintptr_t brk = (uintptr_t) sbrk(0);
+  size_t pad = (WORD - brk) & (MYLLOC_ALIGN - 1);
+  return pad == 0 || grow_heap(pad) != (void*) -1 ? 0 : -1;
+}
+
+// gives the free top chunk back to the system, down to the page it starts in
+static void trim(void) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  char *end = (char*) top + chunk_size(top) + WORD;
+  char *keep = (char*) (((uintptr_t) top + MIN_CHUNK + page - 1) & ~(page - 1)) + WORD;
+  if (keep >= end) {
+    return;
+  }
+  bin_remove(top);
+  set_size(top, keep - WORD - (char*) top);
+  bin_insert(top);
+  grow_heap(-(end - keep));
+}
+
+// serves a huge request from a mapping of its own; a mapped chunk keeps how
+// far into the mapping it starts in prev_size
+static void *mmap_chunk(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t length = (size + 2 * WORD + page - 1) & ~(page - 1);
+  char *mapping = mmap(NULL, length + GUARD_PAGES * page, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+  size_t offset = 0;
+  if (GUARD_PAGES) {
+    mprotect(mapping + length, page, PROT_NONE);
+    offset = (length - size - 2 * WORD) & ~((size_t) MYLLOC_ALIGN - 1);
+  }
+  struct chunk *chunk = (struct chunk*) (mapping + offset);
+  chunk->prev_size = offset;
+  chunk->head = (length - offset) | MYLLOC_INUSE | MYLLOC_MMAPPED;
+  atomic_fetch_add_explicit(&mapped_bytes, chunk_size(chunk), memory_order_relaxed);
+  return (void*)(chunk + 1);
+}
+
+static void unmap_chunk(struct chunk *chunk) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  munmap((char*) chunk - chunk->prev_size, chunk->prev_size + chunk_size(chunk) + GUARD_PAGES * page);
+}
+
+// takes a chunk of asize bytes from the bins or the top of the heap;
+// the caller holds heap_lock
+static void *heap_malloc(size_t asize) {
+  int bin = mylloc_bin(asize);
+  struct chunk *current = NULL;
+
+  if (bin < MYLLOC_SMALL_BINS) {
+    // every chunk in a small bin has exactly the right size, so the
+    // first non-empty bin from this one up holds the best fit
+    unsigned long long fits = binmap & (~0ULL << bin);
+    if (fits != 0) {
+      current = bins[__builtin_ctzll(fits)];
+      bin_remove(current);
+    }
+  }
+
+  if (current == NULL) {
+    current = tree_best_fit(asize);
+    if (current != NULL) {
+      bin_remove(current);
+    }
+  }
+
+  if (current == NULL && top != NULL && !in_use(top)) {
+    // grow the free chunk at the top of the heap instead of adding a new one
+    if (grow_heap(asize - chunk_size(top)) == (void*) -1) {
+      return NULL;
+    }
+    bin_remove(top);
+    set_size(top, asize);
+    current = top;
+  }
+
+  if (current != NULL) {
+    split(current, asize);
+    current->head |= MYLLOC_INUSE;
+    set_tag(current);
+    return (void*)(current + 1);
+  }
+
+  if (top == NULL && start_heap() != 0) {
+    return NULL;
+  }
+  char *brk = grow_heap(asize);
+  if (brk == (void*) -1 || brk == NULL) {
+    return NULL;
+  }
+
+  // the top chunk is in use, or it would have been grown
+  struct chunk *new_chunk = (struct chunk*) (brk - WORD);
+  new_chunk->head = asize | MYLLOC_INUSE | MYLLOC_PREV_INUSE;
+  if (top == NULL) {
+    bottom = new_chunk;
+  }
+  top = new_chunk;
 
-void *malloc(size_t size) {
-  if (size == 0) return NULL;
-
-  struct chunk *prev = NULL;
-  struct chunk *current = flist;
-  
-  while (current != NULL) {
-    if (current->size >= size && current->used == 0) {
-      current->used = size;
-      
-      if (current == flist) {
-        flist = current->next;
-      } else if (prev != NULL) {
-        prev->next = current->next;
-      }
-      
-      return (void*)(current + 1);
-    }
-    
-    prev = current;
-    current = current->next;
-  }
-  
-  struct chunk *new_chunk = sbrk(sizeof(struct chunk) + size);
-  if (new_chunk == (void*) -1) {
-    return NULL;
-  }
-  
-  new_chunk->size = size;
-  new_chunk->used = size;
-  new_chunk->next = NULL;
-  
   return (void*)(new_chunk + 1);
 }
 
-void free(void *memory) {
+// returns a chunk to the bins; the caller holds heap_lock
+static void heap_free(struct chunk *chunk) {
+  chunk->head &= ~(size_t) MYLLOC_INUSE;
+
+  // merge with the chunk above, then the one below, so no two free chunks touch
+  if (chunk != top) {
+    struct chunk *next = next_chunk(chunk);
+    if (!in_use(next)) {
+      bin_remove(next);
+      set_size(chunk, chunk_size(chunk) + chunk_size(next));
+      if (next == top) {
+        top = chunk;
+      }
+    }
+  }
+  if (!(chunk->head & MYLLOC_PREV_INUSE)) {
+    struct chunk *prev = prev_chunk(chunk);
+    bin_remove(prev);
+    set_size(prev, chunk_size(prev) + chunk_size(chunk));
+    if (chunk == top) {
+      top = prev;
+    }
+    chunk = prev;
+  }
+
+  set_tag(chunk);
+  bin_insert(chunk);
+  if (chunk == top && chunk_size(chunk) > MYLLOC_TRIM_THRESHOLD) {
+    trim();
+  }
+}
+
+// gives the bytes of a used chunk past asize back to the heap;
+// the caller holds heap_lock
+static void shrink(struct chunk *chunk, size_t asize) {
+  if (chunk_size(chunk) - asize < MIN_CHUNK) {
+    return;
+  }
+  struct chunk *rest = (struct chunk*) ((char*) chunk + asize);
+  rest->head = (chunk_size(chunk) - asize) | MYLLOC_INUSE | MYLLOC_PREV_INUSE;
+  set_size(chunk, asize);
+  if (chunk == top) {
+    top = rest;
+  }
+  heap_free(rest);
+}
+
+// hands everything in the thread's cache and its counts back when it exits
+static void tcache_release(void *arg) {
+  struct tcache *cache = arg;
+  pthread_mutex_lock(&heap_lock);
+  for (int bin = 0; bin < MYLLOC_TCACHE_BINS; bin++) {
+    while (cache->list[bin] != NULL) {
+      struct chunk *chunk = cache->list[bin];
+      cache->list[bin] = MYLLOC_LINKS(chunk)->next;
+      bump(&cache->counts.cached, -chunk_size(chunk));
+      heap_free(chunk);
+    }
+    cache->count[bin] = 0;
+  }
+  for (struct tcache **link = &threads; *link != NULL; link = &(*link)->next) {
+    if (*link == cache) {
+      *link = cache->next;
+      break;
+    }
+  }
+  move_counts(&retired, &cache->counts);
+  cache->registered = 0;
+  cache->exited = 1;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+// moves a batch of chunks for one size class from the central heap to the cache
+static void tcache_fill(int bin, size_t asize) {
+  // make sure the cache is emptied when the thread exits
+  struct counts *counts = thread_counts();
+  if (tcache.exited) {
+    return;
+  }
+  int batch = mylloc_tcache_count < MYLLOC_TCACHE_BATCH ? mylloc_tcache_count : MYLLOC_TCACHE_BATCH;
+  pthread_mutex_lock(&heap_lock);
+  for (int i = 0; i < batch; i++) {
+    void *memory = heap_malloc(asize);
+    if (memory == NULL) {
+      break;
+    }
+    struct chunk *chunk = ((struct chunk*) memory) - 1;
+    MYLLOC_LINKS(chunk)->next = tcache.list[bin];
+    tcache.list[bin] = chunk;
+    tcache.count[bin]++;
+    bump(&counts->cached, chunk_size(chunk));
+  }
+  sample_peak();
+  pthread_mutex_unlock(&heap_lock);
+}
+
+// malloc(0) hands out the smallest chunk, since many programs take NULL
+// from malloc to mean it ran out of memory
+static void *allocate_block(size_t size) {
+  if (size > MAX_REQUEST) return NULL;
+
+  if (size >= MYLLOC_MMAP_THRESHOLD) {
+    void *memory = mmap_chunk(size);
+    if (memory != NULL) {
+      count_alloc(usable(((struct chunk*) memory) - 1));
+      pthread_mutex_lock(&heap_lock);
+      sample_peak();
+      pthread_mutex_unlock(&heap_lock);
+    }
+    return memory;
+  }
+
+  size_t asize = request_size(size);
+  int bin = mylloc_bin(asize);
+
+  if (bin < MYLLOC_TCACHE_BINS && mylloc_tcache_count > 0) {
+    if (tcache.list[bin] == NULL) {
+      tcache_fill(bin, asize);
+    }
+    struct chunk *chunk = tcache.list[bin];
+    if (chunk != NULL) {
+      tcache.list[bin] = MYLLOC_LINKS(chunk)->next;
+      tcache.count[bin]--;
+      count_cached(-chunk_size(chunk));
+      count_alloc(usable(chunk));
+      return (void*)(chunk + 1);
+    }
+  }
+
+  // registering takes heap_lock, so it has to happen before the lock is held
+  thread_counts();
+  pthread_mutex_lock(&heap_lock);
+  void *memory = heap_malloc(asize);
+  if (memory != NULL) {
+    count_alloc(usable(((struct chunk*) memory) - 1));
+    sample_peak();
+  }
+  pthread_mutex_unlock(&heap_lock);
+  return memory;
+}
+
+static void release_block(void *memory) {
   if (memory == NULL) return;
-  
+
   struct chunk *chunk = ((struct chunk*)memory) - 1;
-  
-  chunk->used = 0;
-  
-  chunk->next = flist;
-  flist = chunk;
+  count_free(usable(chunk));
+  if (chunk->head & MYLLOC_MMAPPED) {
+    atomic_fetch_sub_explicit(&mapped_bytes, chunk_size(chunk), memory_order_relaxed);
+    unmap_chunk(chunk);
+    return;
+  }
+  int bin = mylloc_bin(chunk_size(chunk));
+
+  if (bin < MYLLOC_TCACHE_BINS && tcache.count[bin] < mylloc_tcache_count && !tcache.exited) {
+    MYLLOC_LINKS(chunk)->next = tcache.list[bin];
+    tcache.list[bin] = chunk;
+    tcache.count[bin]++;
+    count_cached(chunk_size(chunk));
+    return;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  heap_free(chunk);
+  // a full cache gives back half of its chunks in the same trip
+  if (bin < MYLLOC_TCACHE_BINS) {
+    while (tcache.count[bin] > mylloc_tcache_count / 2) {
+      struct chunk *cached = tcache.list[bin];
+      tcache.list[bin] = MYLLOC_LINKS(cached)->next;
+      tcache.count[bin]--;
+      count_cached(-chunk_size(cached));
+      heap_free(cached);
+    }
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void *resize_block(void *memory, size_t size) {
+  if (memory == NULL) return allocate_block(size);
+  if (size == 0) {
+    release_block(memory);
+    return NULL;
+  }
+  if (size > MAX_REQUEST) return NULL;
+
+  struct chunk *chunk = ((struct chunk*)memory) - 1;
+  size_t asize = request_size(size);
+  size_t old_usable = usable(chunk);
+
+  if (chunk->head & MYLLOC_MMAPPED) {
+    if (size >= MYLLOC_MMAP_THRESHOLD && !GUARD_PAGES) {
+      // let the kernel move or resize the pages instead of copying them
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t length = (size + 2 * WORD + page - 1) & ~(page - 1);
+      size_t old_length = chunk_size(chunk);
+      struct chunk *moved = mremap(chunk, old_length, length, MREMAP_MAYMOVE);
+      if (moved == MAP_FAILED) {
+        return NULL;
+      }
+      set_size(moved, length);
+      atomic_fetch_add_explicit(&mapped_bytes, length - old_length, memory_order_relaxed);
+      count_free(old_usable);
+      count_alloc(usable(moved));
+      return (void*)(moved + 1);
+    }
+  } else {
+    int resized = 0;
+    thread_counts();
+    pthread_mutex_lock(&heap_lock);
+    if (asize <= chunk_size(chunk)) {
+      resized = 1;
+    } else if (chunk == top) {
+      if (grow_heap(asize - chunk_size(chunk)) != (void*) -1) {
+        set_size(chunk, asize);
+        resized = 1;
+      }
+    } else {
+      // grow into the chunk above if it is free and big enough
+      struct chunk *next = next_chunk(chunk);
+      if (!in_use(next) && chunk_size(chunk) + chunk_size(next) >= asize) {
+        bin_remove(next);
+        set_size(chunk, chunk_size(chunk) + chunk_size(next));
+        if (next == top) {
+          top = chunk;
+        }
+        set_tag(chunk);
+        resized = 1;
+      }
+    }
+    if (resized) {
+      shrink(chunk, asize);
+      count_free(old_usable);
+      count_alloc(usable(chunk));
+    }
+    pthread_mutex_unlock(&heap_lock);
+    if (resized) {
+      return memory;
+    }
+  }
+
+  void *moved = allocate_block(size);
+  if (moved == NULL) {
+    return NULL;
+  }
+  memcpy(moved, memory, old_usable < size ? old_usable : size);
+  release_block(memory);
+  return moved;
+}
+
+static int allocate_aligned_block(void **result, size_t align, size_t size) {
+  if (align < sizeof(void*) || (align & (align - 1)) != 0) {
+    return EINVAL;
+  }
+  if (align <= MYLLOC_ALIGN) {
+    *result = allocate_block(size);
+    return *result == NULL ? ENOMEM : 0;
+  }
+  if (align > MAX_REQUEST / 4 || size > MAX_REQUEST / 4) {
+    return ENOMEM;
+  }
+
+  // take enough to fit an aligned chunk with a free chunk below it
+  size_t asize = request_size(size);
+  thread_counts();
+  pthread_mutex_lock(&heap_lock);
+  void *memory = heap_malloc(asize + align + MIN_CHUNK);
+  if (memory == NULL) {
+    pthread_mutex_unlock(&heap_lock);
+    return ENOMEM;
+  }
+  struct chunk *chunk = ((struct chunk*) memory) - 1;
+  if (((uintptr_t) memory & (align - 1)) != 0) {
+    uintptr_t aligned = ((uintptr_t) memory + MIN_CHUNK + align - 1) & ~(align - 1);
+    struct chunk *body = ((struct chunk*) aligned) - 1;
+    size_t lead = (char*) body - (char*) chunk;
+    body->head = (chunk_size(chunk) - lead) | MYLLOC_INUSE;
+    set_size(chunk, lead);
+    if (chunk == top) {
+      top = body;
+    }
+    heap_free(chunk);
+    chunk = body;
+  }
+  shrink(chunk, asize);
+  count_alloc(usable(chunk));
+  sample_peak();
+  pthread_mutex_unlock(&heap_lock);
+
+  *result = chunk + 1;
+  return 0;
+}
+
+#ifdef MYLLOC_DEBUG
+static void debug_failed(const char *op, void *memory, const char *problem) {
+  fprintf(stderr, "mylloc: %s(%p): %s\n", op, memory, problem);
+  abort();
+}
+
+static size_t *trailer(void *memory) {
+  return (size_t*) ((char*) memory + usable(((struct chunk*) memory) - 1) - WORD);
+}
+
+// fills in the canary and size of a block of size bytes just handed out
+static void *stamp(void *memory, size_t size) {
+  if (memory != NULL) {
+    size_t *end = trailer(memory);
+    memset((char*) memory + size, CANARY, (char*) end - ((char*) memory + size));
+    *end = size;
+  }
+  return memory;
+}
+
+// checks a block the program hands back
+static void inspect(void *memory, const char *op) {
+  struct chunk *chunk = ((struct chunk*) memory) - 1;
+  if ((uintptr_t) memory & (MYLLOC_ALIGN - 1)) {
+    debug_failed(op, memory, "not a block from malloc");
+  }
+  size_t *end = trailer(memory);
+  if (!in_use(chunk) || *end == FREED) {
+    debug_failed(op, memory, "block is already free");
+  }
+  if (*end > usable(chunk) - DEBUG_SPACE) {
+    debug_failed(op, memory, "size after the block was overwritten");
+  }
+  for (unsigned char *c = (unsigned char*) memory + *end; c < (unsigned char*) end; c++) {
+    if (*c != CANARY) {
+      debug_failed(op, memory, "written past the end of the block");
+    }
+  }
+}
+#endif
+
+static void *allocate(size_t size) {
+#ifdef MYLLOC_DEBUG
+  if (size > MAX_REQUEST) return NULL;
+  return stamp(allocate_block(size + DEBUG_SPACE), size);
+#else
+  return allocate_block(size);
+#endif
+}
+
+static void release(void *memory) {
+#ifdef MYLLOC_DEBUG
+  if (memory != NULL) {
+    inspect(memory, "free");
+    *trailer(memory) = FREED;
+  }
+#endif
+  release_block(memory);
+}
+
+static void *resize(void *memory, size_t size) {
+#ifdef MYLLOC_DEBUG
+  if (memory == NULL) return allocate(size);
+  if (size == 0) {
+    release(memory);
+    return NULL;
+  }
+  if (size > MAX_REQUEST) return NULL;
+  inspect(memory, "realloc");
+  return stamp(resize_block(memory, size + DEBUG_SPACE), size);
+#else
+  return resize_block(memory, size);
+#endif
+}
+
+static int allocate_aligned(void **result, size_t align, size_t size) {
+#ifdef MYLLOC_DEBUG
+  if (size > MAX_REQUEST) return ENOMEM;
+  int status = allocate_aligned_block(result, align, size + DEBUG_SPACE);
+  if (status == 0) {
+    stamp(*result, size);
+  }
+  return status;
+#else
+  return allocate_aligned_block(result, align, size);
+#endif
+}
+
+// Everything below is the public interface. Each function records what it
+// did for MYLLOC_TRACE, with its own caller as the call site.
+#define TRACE(op, address, size) do { \
+    if (mylloc_tracing && (address) != NULL) { \
+      mylloc_trace(op, address, size, __builtin_return_address(0)); \
+    } \
+  } while (0)
+
+void *malloc(size_t size) {
+  void *memory = allocate(size);
+  TRACE(MYLLOC_TRACE_ALLOC, memory, size);
+  return memory;
+}
+
+void free(void *memory) {
+  TRACE(MYLLOC_TRACE_FREE, memory, 0);
+  release(memory);
+}
+
+void *calloc(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void *memory = allocate(count * size);
+  // fresh mappings are already zero
+  if (memory != NULL && count * size < MYLLOC_MMAP_THRESHOLD) {
+    memset(memory, 0, count * size);
+  }
+  TRACE(MYLLOC_TRACE_ALLOC, memory, count * size);
+  return memory;
+}
+
+// a resize is traced as freeing the old block and allocating the new one
+#define TRACE_RESIZE(memory, moved, size) do { \
+    if ((moved) != NULL || (size) == 0) { \
+      TRACE(MYLLOC_TRACE_FREE, memory, 0); \
+    } \
+    TRACE(MYLLOC_TRACE_ALLOC, moved, size); \
+  } while (0)
+
+void *realloc(void *memory, size_t size) {
+  void *moved = resize(memory, size);
+  TRACE_RESIZE(memory, moved, size);
+  return moved;
+}
+
+void *reallocarray(void *memory, size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void *moved = resize(memory, count * size);
+  TRACE_RESIZE(memory, moved, count * size);
+  return moved;
+}
+
+int posix_memalign(void **result, size_t align, size_t size) {
+  int status = allocate_aligned(result, align, size);
+  if (status == 0) {
+    TRACE(MYLLOC_TRACE_ALLOC, *result, size);
+  }
+  return status;
+}
+
+// the memalign family accepts any power of two as the alignment
+static void *aligned(size_t align, size_t size) {
+  void *memory;
+  if (allocate_aligned(&memory, align < sizeof(void*) ? sizeof(void*) : align, size) != 0) {
+    return NULL;
+  }
+  return memory;
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+  void *memory = aligned(align, size);
+  TRACE(MYLLOC_TRACE_ALLOC, memory, size);
+  return memory;
+}
+
+void *memalign(size_t align, size_t size) {
+  void *memory = aligned(align, size);
+  TRACE(MYLLOC_TRACE_ALLOC, memory, size);
+  return memory;
+}
+
+void *valloc(size_t size) {
+  void *memory = aligned(sysconf(_SC_PAGESIZE), size);
+  TRACE(MYLLOC_TRACE_ALLOC, memory, size);
+  return memory;
+}
+
+void *pvalloc(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  void *memory = aligned(page, (size + page - 1) & ~(page - 1));
+  TRACE(MYLLOC_TRACE_ALLOC, memory, size);
+  return memory;
+}
+
+size_t malloc_usable_size(void *memory) {
+  if (memory == NULL) return 0;
+#ifdef MYLLOC_DEBUG
+  // the bytes past the size asked for belong to the canary
+  return *trailer(memory);
+#else
+  return usable(((struct chunk*) memory) - 1);
+#endif
+}
+
+void mylloc_stats(struct mylloc_stats *stats) {
+  struct counts sum;
+  memset(&sum, 0, sizeof(sum));
+  pthread_mutex_lock(&heap_lock);
+  sample_peak();
+  stats->heap = heap_bytes;
+  stats->free = free_bytes;
+  stats->free_blocks = free_blocks;
+  stats->peak_in_use = peak_in_use;
+  for (struct tcache *thread = threads; thread != NULL; thread = thread->next) {
+    struct counts copy = thread->counts;
+    move_counts(&sum, &copy);
+  }
+  struct counts copy = retired;
+  move_counts(&sum, &copy);
+  pthread_mutex_unlock(&heap_lock);
+  stats->mapped = atomic_load_explicit(&mapped_bytes, memory_order_relaxed);
+  stats->in_use = read_counter(&sum.in_use);
+  stats->in_use_blocks = read_counter(&sum.in_use_blocks);
+  stats->cached = read_counter(&sum.cached);
+  for (int class = 0; class < MYLLOC_HISTOGRAM; class++) {
+    stats->histogram[class] = read_counter(&sum.histogram[class]);
+  }
+}
+
+static int check_errors;
+
+static void check_failed(struct chunk *c, const char *problem) {
+  if (c != NULL) {
+    fprintf(stderr, "mylloc_check: chunk %p: %s\n", (void*) c, problem);
+  } else {
+    fprintf(stderr, "mylloc_check: %s\n", problem);
+  }
+  check_errors++;
+}
+
+// a chunk on a list must start on a chunk boundary inside the heap;
+// returns 0 if it does not, so the caller stops following its links
+static int check_in_heap(struct chunk *c) {
+  if (top == NULL || c < bottom || c > top || ((uintptr_t) c & (MYLLOC_ALIGN - 1)) != 0) {
+    check_failed(c, "list points outside the heap");
+    return 0;
+  }
+  return 1;
+}
+
+// counts the chunks in a subtree, checking their order; budget is how many
+// more chunks may be free, which stops the walk if the tree has a loop
+static size_t check_tree(struct chunk *node, struct chunk *low, struct chunk *high, size_t *budget) {
+  if (node == NULL) {
+    return 0;
+  }
+  if (*budget == 0) {
+    check_failed(node, "free lists hold more chunks than are free");
+    return 0;
+  }
+  (*budget)--;
+  if (!check_in_heap(node)) {
+    return 1;
+  }
+  if (in_use(node)) {
+    check_failed(node, "chunk in the tree is in use");
+  }
+  if (chunk_size(node) <= MYLLOC_SMALL_MAX) {
+    check_failed(node, "small chunk in the tree");
+  }
+  if ((low != NULL && !tree_less(low, node)) || (high != NULL && !tree_less(node, high))) {
+    check_failed(node, "tree is out of order");
+  }
+  return 1 + check_tree(MYLLOC_TREE(node)->left, low, node, budget) +
+         check_tree(MYLLOC_TREE(node)->right, node, high, budget);
+}
+
+int mylloc_check(void) {
+  pthread_mutex_lock(&heap_lock);
+  check_errors = 0;
+
+  // walk every chunk from the bottom of the heap to the top
+  size_t free_found = 0;
+  size_t free_found_bytes = 0;
+  if (top != NULL) {
+    char *end = (char*) top + chunk_size(top);
+    if ((char*) sbrk(0) != end + WORD) {
+      check_failed(top, "top chunk does not end one word below the break");
+    }
+    int below_free = 0;
+    size_t below_size = 0;
+    for (struct chunk *c = bottom; ; c = next_chunk(c)) {
+      if (c > top) {
+        check_failed(c, "chunks overlap the top chunk");
+        break;
+      }
+      size_t size = chunk_size(c);
+      if (size < MIN_CHUNK || (char*) c + size > end) {
+        check_failed(c, "size runs past the top of the heap");
+        break;
+      }
+      if (c->head & MYLLOC_MMAPPED) {
+        check_failed(c, "heap chunk marked as mapped");
+      }
+      if (((c->head & MYLLOC_PREV_INUSE) != 0) == below_free) {
+        check_failed(c, "flag for the chunk below is wrong");
+      } else if (below_free && c->prev_size != below_size) {
+        check_failed(c, "footer of the free chunk below is wrong");
+      }
+      if (!in_use(c)) {
+        if (below_free) {
+          check_failed(c, "free chunk next to another free chunk");
+        }
+        free_found++;
+        free_found_bytes += size;
+      }
+      below_free = !in_use(c);
+      below_size = size;
+      if (c == top) {
+        break;
+      }
+    }
+  }
+
+  // every free chunk must be on exactly one free list
+  size_t budget = free_blocks;
+  size_t listed = 0;
+  for (int bin = 0; bin < MYLLOC_SMALL_BINS; bin++) {
+    if (((binmap >> bin) & 1) != (bins[bin] != NULL)) {
+      check_failed(bins[bin], "binmap does not match the bin");
+    }
+    struct chunk *prev = NULL;
+    for (struct chunk *c = bins[bin]; c != NULL; prev = c, c = MYLLOC_LINKS(c)->next) {
+      if (budget == 0) {
+        check_failed(c, "free lists hold more chunks than are free");
+        break;
+      }
+      budget--;
+      listed++;
+      if (!check_in_heap(c)) {
+        break;
+      }
+      if (in_use(c)) {
+        check_failed(c, "chunk in a bin is in use");
+      }
+      if (mylloc_bin(chunk_size(c)) != bin) {
+        check_failed(c, "chunk is in the wrong bin");
+      }
+      if (MYLLOC_LINKS(c)->prev != prev) {
+        check_failed(c, "link back to the chunk before is wrong");
+      }
+    }
+  }
+  listed += check_tree(mylloc_tree, NULL, NULL, &budget);
+  if (free_found != free_blocks || listed != free_blocks || free_found_bytes != free_bytes) {
+    check_failed(NULL, "free chunks in the heap do not match the free lists");
+  }
+
+  // chunks in this thread's cache are in use as far as the heap knows
+  for (int bin = 0; bin < MYLLOC_TCACHE_BINS; bin++) {
+    int count = 0;
+    for (struct chunk *c = tcache.list[bin]; c != NULL && count <= tcache.count[bin];
+         c = MYLLOC_LINKS(c)->next) {
+      count++;
+      if (!check_in_heap(c)) {
+        break;
+      }
+      // a batch can hold chunks a little bigger than the bin, when the
+      // rest was too small to split off
+      if (!in_use(c) || chunk_size(c) < mylloc_bin_size(bin)
+          || chunk_size(c) >= mylloc_bin_size(bin) + MIN_CHUNK) {
+        check_failed(c, "thread cache holds a free chunk or one of the wrong size");
+      }
+    }
+    if (count != tcache.count[bin]) {
+      check_failed(tcache.list[bin], "thread cache holds the wrong number of chunks");
+    }
+  }
+
+  int errors = check_errors;
+  pthread_mutex_unlock(&heap_lock);
+  return errors;
 }
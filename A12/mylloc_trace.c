@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "mylloc.h"
+
+// Nothing here may call malloc: buffers come from mmap and records go
+// straight to the file with write.
+
+struct trace_buffer {
+  struct trace_buffer *next;  // every buffer, so the process can flush them on exit
+  int count;
+  int thread;
+  struct mylloc_trace_record records[MYLLOC_TRACE_RECORDS];
+};
+
+int mylloc_tracing = 0;
+
+static int trace_fd = -1;
+static __thread struct trace_buffer *buffer __attribute__((tls_model("initial-exec")));
+static struct trace_buffer *buffers = NULL;
+static int threads = 0;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buffer_key;
+
+static void write_all(int fd, const void *data, size_t bytes) {
+  const char *next = data;
+  while (bytes > 0) {
+    ssize_t written = write(fd, next, bytes);
+    if (written <= 0) {
+      return;
+    }
+    next += written;
+    bytes -= written;
+  }
+}
+
+// O_APPEND keeps each flush in one piece even with many threads writing
+static void flush(struct trace_buffer *b) {
+  write_all(trace_fd, b->records, b->count * sizeof(struct mylloc_trace_record));
+  b->count = 0;
+}
+
+static void buffer_release(void *arg) {
+  struct trace_buffer *b = arg;
+  pthread_mutex_lock(&buffers_lock);
+  flush(b);
+  for (struct trace_buffer **link = &buffers; *link != NULL; link = &(*link)->next) {
+    if (*link == b) {
+      *link = b->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&buffers_lock);
+  if (buffer == b) {
+    buffer = NULL;
+  }
+  munmap(b, sizeof(struct trace_buffer));
+}
+
+static struct trace_buffer *buffer_create(void) {
+  struct trace_buffer *b = mmap(NULL, sizeof(struct trace_buffer), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (b == MAP_FAILED) {
+    return NULL;
+  }
+  pthread_mutex_lock(&buffers_lock);
+  b->count = 0;
+  b->thread = threads++;
+  b->next = buffers;
+  buffers = b;
+  pthread_mutex_unlock(&buffers_lock);
+  pthread_setspecific(buffer_key, b);
+  buffer = b;
+  return b;
+}
+
+static void __attribute__((destructor)) trace_stop(void) {
+  if (!mylloc_tracing) {
+    return;
+  }
+  mylloc_tracing = 0;
+  pthread_mutex_lock(&buffers_lock);
+  for (struct trace_buffer *b = buffers; b != NULL; b = b->next) {
+    flush(b);
+  }
+  pthread_mutex_unlock(&buffers_lock);
+  close(trace_fd);
+}
+
+// copies /proc/self/maps so call sites can be matched to the file they are in
+static void save_maps(const char *path) {
+  char maps_path[PATH_MAX];
+  size_t len = strlen(path);
+  if (len + sizeof(".maps") > sizeof(maps_path)) {
+    return;
+  }
+  memcpy(maps_path, path, len);
+  memcpy(maps_path + len, ".maps", sizeof(".maps"));
+
+  int in = open("/proc/self/maps", O_RDONLY);
+  int out = open(maps_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  char data[4096];
+  ssize_t bytes;
+  while (in >= 0 && out >= 0 && (bytes = read(in, data, sizeof(data))) > 0) {
+    write_all(out, data, bytes);
+  }
+  if (in >= 0) close(in);
+  if (out >= 0) close(out);
+}
+
+// copies pattern to path with each %p replaced by the process id
+static int expand_path(char *path, size_t size, const char *pattern) {
+  char pid[24];
+  int digits = 0;
+  for (unsigned long n = getpid(); n > 0 || digits == 0; n /= 10) {
+    pid[digits++] = '0' + n % 10;
+  }
+  size_t len = 0;
+  int per_process = 0;
+  for (const char *c = pattern; *c != '\0'; c++) {
+    if (c[0] == '%' && c[1] == 'p') {
+      for (int i = digits - 1; i >= 0 && len < size; i--) {
+        path[len++] = pid[i];
+      }
+      per_process = 1;
+      c++;
+    } else if (len < size) {
+      path[len++] = *c;
+    }
+  }
+  if (len >= size) {
+    return -1;
+  }
+  path[len] = '\0';
+  return per_process;
+}
+
+void mylloc_trace_start(void) {
+  const char *pattern = getenv("MYLLOC_TRACE");
+  char path[PATH_MAX];
+  if (pattern == NULL || *pattern == '\0' || mylloc_tracing) {
+    return;
+  }
+  int per_process = expand_path(path, sizeof(path), pattern);
+  if (per_process < 0) {
+    return;
+  }
+  // without %p, programs this one starts would overwrite its trace
+  if (!per_process) {
+    unsetenv("MYLLOC_TRACE");
+  }
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (trace_fd < 0) {
+    return;
+  }
+  write_all(trace_fd, MYLLOC_TRACE_MAGIC, strlen(MYLLOC_TRACE_MAGIC));
+  save_maps(path);
+  pthread_key_create(&buffer_key, buffer_release);
+  mylloc_tracing = 1;
+}
+
+void mylloc_trace(int op, void *address, size_t size, void *caller) {
+  struct trace_buffer *b = buffer;
+  if (b == NULL && (b = buffer_create()) == NULL) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct mylloc_trace_record *record = &b->records[b->count];
+  record->time = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  record->address = (uintptr_t) address;
+  record->caller = (uintptr_t) caller;
+  record->size = size;
+  record->thread = b->thread;
+  record->op = op;
+  record->pad = 0;
+  if (++b->count == MYLLOC_TRACE_RECORDS) {
+    flush(b);
+  }
+}
+
+void mylloc_trace_fork_child(void) {
+  if (!mylloc_tracing) {
+    return;
+  }
+  // the parent still has these records and will write them itself
+  mylloc_tracing = 0;
+  pthread_mutex_init(&buffers_lock, NULL);
+  for (struct trace_buffer *b = buffers; b != NULL; b = b->next) {
+    b->count = 0;
+  }
+  close(trace_fd);
+  trace_fd = -1;
+}
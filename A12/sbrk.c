@@ -1,36 +1,56 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
 #define MAX_HEAP 64*1024*4096
 
-char *heap;
-char *brkp = NULL;
-char *endp = NULL;
-
-static void sbrk_init() __attribute__((constructor));
+static char *heap = NULL;
+static char *brkp = NULL;
+static char *endp = NULL;
 
 // Allocates a big block of memory
-// that we can manage ourselves
-void sbrk_init() {
-  heap = (char*) mmap(NULL, MAX_HEAP,
+// that we can manage ourselves.
+// This happens on the first call rather than in a constructor, since
+// malloc can be called before any constructor has run.
+static int sbrk_init() {
+  char* memory = (char*) mmap(NULL, MAX_HEAP,
     (PROT_READ | PROT_WRITE) ,
     (MAP_PRIVATE | MAP_ANONYMOUS) , -1,
     0) ;
+  if (memory == MAP_FAILED) {
+    return -1;
+  }
 
+  heap = memory;
   brkp = heap;
   endp = brkp + MAX_HEAP;
+  return 0;
 }
 
-void* sbrk(size_t size) {
+// Moves the break by size bytes, which may be negative, and returns the old
+// break, or (void*) -1 if the heap would leave the mapping. Pages given back
+// are dropped so they no longer count towards the process's memory.
+void* sbrk(intptr_t size) {
+  if (heap == NULL && sbrk_init() != 0) {
+    return (void *) -1;
+  }
   if (size == 0) {
     return (void *) brkp;
   }
+  if (size > endp - brkp || -size > brkp - heap) {
+    return (void *) -1;
+  }
 
-  void* free = (void *) brkp;
+  char* old = brkp;
   brkp += size;
-  if ( brkp >= endp ) {
-    return NULL;
+  if (size < 0) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    char* start = (char*) (((uintptr_t) brkp + page - 1) & ~(page - 1));
+    char* end = (char*) (((uintptr_t) old + page - 1) & ~(page - 1));
+    if (start < end) {
+      madvise(start, end - start, MADV_DONTNEED);
+    }
   }
-  return free;
+  return (void *) old;
 }
-
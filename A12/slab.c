@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "slab.h"
+
+// Each slab starts with this header, padded to SLAB_ALIGN, then its objects.
+struct slab {
+  struct slab *next;
+};
+
+#define SLAB_HEADER ((sizeof(struct slab) + SLAB_ALIGN - 1) & ~((size_t) SLAB_ALIGN - 1))
+
+struct slab_pool *slab_create(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size == 0 || size > (SIZE_MAX - page) / (2 * SLAB_MIN_OBJECTS)) {
+    return NULL;
+  }
+  struct slab_pool *pool = malloc(sizeof(struct slab_pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  // a free object holds the link to the next one
+  if (size < sizeof(void*)) {
+    size = sizeof(void*);
+  }
+  pool->size = (size + SLAB_ALIGN - 1) & ~((size_t) SLAB_ALIGN - 1);
+  pool->slab_size = (SLAB_HEADER + SLAB_MIN_OBJECTS * pool->size + page - 1) & ~(page - 1);
+  pool->slabs = NULL;
+  pool->current = NULL;
+  pool->next = NULL;
+  pool->end = NULL;
+  pool->free_list = NULL;
+  pool->in_use = 0;
+  pool->slab_count = 0;
+  return pool;
+}
+
+// moves on to the slab after current, mapping a new one when every slab is
+// in use; returns 0 on success
+static int next_slab(struct slab_pool *pool) {
+  struct slab *slab = pool->current == NULL ? pool->slabs : pool->current->next;
+  if (slab == NULL) {
+    slab = mmap(NULL, pool->slab_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+      return -1;
+    }
+    slab->next = NULL;
+    if (pool->current == NULL) {
+      pool->slabs = slab;
+    } else {
+      pool->current->next = slab;
+    }
+    pool->slab_count++;
+  }
+  pool->current = slab;
+  pool->next = (char*) slab + SLAB_HEADER;
+  pool->end = (char*) slab + pool->slab_size;
+  return 0;
+}
+
+void *slab_alloc(struct slab_pool *pool) {
+  void *object = pool->free_list;
+  if (object != NULL) {
+    pool->free_list = *(void**) object;
+  } else {
+    if ((size_t) (pool->end - pool->next) < pool->size && next_slab(pool) != 0) {
+      return NULL;
+    }
+    object = pool->next;
+    pool->next += pool->size;
+  }
+  pool->in_use++;
+  return object;
+}
+
+void slab_free(struct slab_pool *pool, void *object) {
+  if (object == NULL) return;
+  *(void**) object = pool->free_list;
+  pool->free_list = object;
+  pool->in_use--;
+}
+
+void slab_reset(struct slab_pool *pool) {
+  pool->current = NULL;
+  pool->next = NULL;
+  pool->end = NULL;
+  pool->free_list = NULL;
+  pool->in_use = 0;
+}
+
+void slab_destroy(struct slab_pool *pool) {
+  if (pool == NULL) return;
+  struct slab *slab = pool->slabs;
+  while (slab != NULL) {
+    struct slab *next = slab->next;
+    munmap(slab, pool->slab_size);
+    slab = next;
+  }
+  free(pool);
+}
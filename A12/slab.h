@@ -0,0 +1,45 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+
+// A slab pool hands out objects of one size. It maps memory a slab at a time
+// (a page, or enough pages for SLAB_MIN_OBJECTS objects) and carves objects
+// out of it back to back, so an object carries no header at all. Freed
+// objects are kept on a list linked through their first word and handed out
+// again first. A pool has no lock: callers that share one between threads
+// must hold a lock of their own around every call.
+#define SLAB_ALIGN 16
+#define SLAB_MIN_OBJECTS 8
+
+struct slab;
+
+struct slab_pool {
+  size_t size;            // bytes per object, a multiple of SLAB_ALIGN
+  size_t slab_size;       // bytes per slab, a multiple of the page size
+  struct slab *slabs;     // every slab the pool has mapped, oldest first
+  struct slab *current;   // the slab objects are carved from now
+  char *next;             // next object never handed out in current
+  char *end;              // end of current
+  void *free_list;        // freed objects, linked through their first word
+  size_t in_use;          // objects handed out and not freed
+  size_t slab_count;
+};
+
+// returns a pool for objects of size bytes, or NULL if size is 0 or there
+// is no memory for the pool
+extern struct slab_pool *slab_create(size_t size);
+
+// returns an object aligned to SLAB_ALIGN, or NULL if no slab can be mapped
+extern void *slab_alloc(struct slab_pool *pool);
+
+// gives back an object from slab_alloc on the same pool; NULL is ignored
+extern void slab_free(struct slab_pool *pool, void *object);
+
+// frees every object in the pool at once; the slabs are kept for reuse
+extern void slab_reset(struct slab_pool *pool);
+
+// unmaps every slab and frees the pool
+extern void slab_destroy(struct slab_pool *pool);
+
+#endif
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "mylloc.h"
+
+// Runs millions of random allocator calls on several threads, checking that
+// no block ever loses its contents and calling mylloc_check along the way.
+// make debug builds it with MYLLOC_DEBUG, so the canaries and guard pages
+// are on too; before the random run it makes sure they catch the mistakes
+// they are there for.
+
+#define MAX_THREADS 64
+#define SLOTS 1024
+#define SHARED 256
+
+struct slot {
+  unsigned char* memory;
+  size_t size;
+  unsigned char fill;
+};
+
+struct worker {
+  pthread_t thread;
+  int id;
+  unsigned seed;
+};
+
+static long ops = 4000000;
+static long check_every = 100000;
+static int num_threads = 4;
+
+// blocks passed between threads, so some are freed by a thread that did
+// not allocate them
+static struct slot shared[SHARED];
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned next_rand(unsigned* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+static void failed(int thread, long op, const char* problem, struct slot* slot) {
+  printf("thread %d, operation %ld: %s (block %p, %zu bytes)\n",
+         thread, op, problem, (void*) slot->memory, slot->size);
+  exit(1);
+}
+
+// mostly small blocks, some medium ones, and now and then one big enough to be mapped
+static size_t random_size(unsigned* seed) {
+  unsigned r = next_rand(seed);
+  if (r % 100 < 80) return r / 100 % 256;
+  if (r % 100 < 99) return 256 + r / 100 % 4096;
+  return 100000 + r / 100 % 300000;
+}
+
+static void verify(int thread, long op, struct slot* slot) {
+  for (size_t i = 0; i < slot->size; i++) {
+    if (slot->memory[i] != (unsigned char) (slot->fill + i)) {
+      failed(thread, op, "block was overwritten", slot);
+    }
+  }
+}
+
+static void fill(struct slot* slot, size_t from) {
+  for (size_t i = from; i < slot->size; i++) {
+    slot->memory[i] = (unsigned char) (slot->fill + i);
+  }
+}
+
+static void release(int thread, long op, struct slot* slot) {
+  verify(thread, op, slot);
+  free(slot->memory);
+  slot->memory = NULL;
+}
+
+static void* run(void* arg) {
+  struct worker* w = arg;
+  struct slot* slots = calloc(SLOTS, sizeof(struct slot));
+  long count = ops / num_threads;
+  for (long op = 0; op < count; op++) {
+    struct slot* slot = &slots[next_rand(&w->seed) % SLOTS];
+    unsigned kind = next_rand(&w->seed) % 10;
+
+    if (slot->memory == NULL) {
+      slot->size = random_size(&w->seed);
+      slot->fill = next_rand(&w->seed);
+      if (kind < 6) {
+        slot->memory = malloc(slot->size);
+      } else if (kind < 8) {
+        slot->memory = calloc(1, slot->size);
+        for (size_t i = 0; i < slot->size; i++) {
+          if (slot->memory[i] != 0) {
+            failed(w->id, op, "calloc block is not zero", slot);
+          }
+        }
+      } else {
+        size_t align = (size_t) 32 << next_rand(&w->seed) % 8;
+        void* memory = NULL;
+        if (posix_memalign(&memory, align, slot->size) != 0 || ((uintptr_t) memory & (align - 1)) != 0) {
+          failed(w->id, op, "posix_memalign block is not aligned", slot);
+        }
+        slot->memory = memory;
+      }
+      if (slot->memory == NULL || malloc_usable_size(slot->memory) < slot->size) {
+        failed(w->id, op, "allocation failed or is too small", slot);
+      }
+      fill(slot, 0);
+    } else if (kind < 5) {
+      release(w->id, op, slot);
+    } else if (kind < 8) {
+      verify(w->id, op, slot);
+      size_t old_size = slot->size;
+      slot->size = random_size(&w->seed);
+      unsigned char* moved = realloc(slot->memory, slot->size);
+      if (moved == NULL && slot->size != 0) {
+        failed(w->id, op, "realloc failed", slot);
+      }
+      slot->memory = moved;
+      if (moved != NULL) {
+        size_t kept = old_size < slot->size ? old_size : slot->size;
+        size_t real_size = slot->size;
+        slot->size = kept;
+        verify(w->id, op, slot);
+        slot->size = real_size;
+        fill(slot, kept);
+      }
+    } else {
+      // swap the block with one another thread left behind
+      verify(w->id, op, slot);
+      pthread_mutex_lock(&shared_lock);
+      struct slot* other = &shared[next_rand(&w->seed) % SHARED];
+      struct slot mine = *slot;
+      *slot = *other;
+      *other = mine;
+      pthread_mutex_unlock(&shared_lock);
+    }
+
+    if (check_every > 0 && op % check_every == check_every - 1 && mylloc_check() != 0) {
+      failed(w->id, op, "heap check failed", slot);
+    }
+  }
+  for (int i = 0; i < SLOTS; i++) {
+    if (slots[i].memory != NULL) {
+      release(w->id, count, &slots[i]);
+    }
+  }
+  free(slots);
+  return NULL;
+}
+
+#ifdef MYLLOC_DEBUG
+// The mistakes write through volatile pointers so the compiler keeps them,
+// to blocks from a function it cannot see into, so it does not know their size.
+__attribute__((noipa)) static volatile char* block(size_t size) {
+  return malloc(size);
+}
+
+static void overflow_small(void) {
+  volatile char* memory = block(20);
+  memory[20] = 'x';
+  free((void*) memory);
+}
+
+static void overflow_large(void) {
+  volatile char* memory = block(1000);
+  for (int i = 0; i <= 1000; i++) {
+    memory[i] = 'x';
+  }
+  free((void*) memory);
+}
+
+static void double_free_cached(void) {
+  void* volatile memory = malloc(32);
+  free(memory);
+  free(memory);
+}
+
+static void double_free_heap(void) {
+  void* volatile memory = malloc(1000);
+  void* guard = malloc(1000);
+  free(memory);
+  free(memory);
+  free(guard);
+}
+
+static void overflow_mapped(void) {
+  size_t size = 200000;
+  volatile char* memory = block(size);
+  // runs past the canary into the guard page
+  for (size_t i = size; i < size + 4096; i++) {
+    memory[i] = 'x';
+  }
+  free((void*) memory);
+}
+
+// runs mistake in a child process and checks that it is stopped by signal
+static int caught(void (*mistake)(void), int signal, const char* name) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    mistake();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  int ok = WIFSIGNALED(status) && WTERMSIG(status) == signal;
+  printf("%s: %s\n", name, ok ? "PASSED" : "FAILED");
+  return ok;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, ":n:t:s:c:")) != -1) {
+    switch (opt) {
+      case 'n': ops = atol(optarg); break;
+      case 't': num_threads = atoi(optarg); break;
+      case 's': seed = atoi(optarg); break;
+      case 'c': check_every = atol(optarg); break;
+      case '?': printf("usage: %s [-n operations] [-t threads] [-s seed] [-c check every]\n", argv[0]);
+                return 1;
+    }
+  }
+  if (num_threads < 1 || num_threads > MAX_THREADS) {
+    num_threads = 4;
+  }
+
+#ifdef MYLLOC_DEBUG
+  int ok = caught(overflow_small, SIGABRT, "write past a small block is caught") &
+           caught(overflow_large, SIGABRT, "write past a large block is caught") &
+           caught(double_free_cached, SIGABRT, "double free of a cached block is caught") &
+           caught(double_free_heap, SIGABRT, "double free of a heap block is caught") &
+           caught(overflow_mapped, SIGSEGV, "write past a mapped block hits the guard page");
+  if (!ok) {
+    return 1;
+  }
+#endif
+
+  printf("%ld operations on %d threads, seed %u\n", ops, num_threads, seed);
+  fflush(stdout);
+  struct worker workers[MAX_THREADS];
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].id = i;
+    workers[i].seed = seed * 7919 + i;
+    pthread_create(&workers[i].thread, NULL, run, &workers[i]);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  for (int i = 0; i < SHARED; i++) {
+    if (shared[i].memory != NULL) {
+      release(-1, ops, &shared[i]);
+    }
+  }
+
+  int problems = mylloc_check();
+  struct mylloc_stats stats;
+  mylloc_stats(&stats);
+  printf("heap check: %d problems, %zu blocks still in use\n", problems, stats.in_use_blocks);
+  printf("%s\n", problems == 0 ? "PASSED" : "FAILED");
+  return problems == 0 ? 0 : 1;
+}
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include "mylloc.h"
+
+// Summarizes a trace recorded with MYLLOC_TRACE: which call sites hold the
+// most memory at the end of the run. With -r it prints the trace instead in
+// the text form bench replays ("a id size" / "f id").
+
+struct site {
+  uint64_t caller;
+  long allocs;
+  long total;        // bytes ever requested here
+  long live;         // bytes requested here and not freed yet
+  long live_blocks;
+  long peak;         // most live bytes at once
+};
+
+// one live block: where it came from, its size and its id for -r
+struct block {
+  uint64_t address;  // 0 marks an empty slot
+  int site;
+  long id;
+  uint32_t size;
+};
+
+struct mapping {
+  uint64_t start;
+  uint64_t end;
+  uint64_t offset;
+  char name[256];
+};
+
+static struct block* blocks = NULL;
+static long num_slots = 0;
+static long num_blocks = 0;
+
+static struct site* sites = NULL;
+static long num_sites = 0;
+static long* site_slots = NULL;    // open addressing table of indexes into sites, -1 if empty
+static long num_site_slots = 0;
+
+static uint64_t hash(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key;
+}
+
+// returns the slot that holds address, or the empty slot where it would go
+static struct block* find_block(uint64_t address) {
+  uint64_t mask = num_slots - 1;
+  for (uint64_t i = hash(address) & mask; ; i = (i + 1) & mask) {
+    if (blocks[i].address == address || blocks[i].address == 0) {
+      return &blocks[i];
+    }
+  }
+}
+
+static void grow_blocks() {
+  struct block* old = blocks;
+  long old_slots = num_slots;
+  num_slots = num_slots == 0 ? 1024 : num_slots * 2;
+  blocks = calloc(num_slots, sizeof(struct block));
+  for (long i = 0; i < old_slots; i++) {
+    if (old[i].address != 0) {
+      *find_block(old[i].address) = old[i];
+    }
+  }
+  free(old);
+}
+
+// removes a block, moving later entries of its run back so lookups still work
+static void remove_block(struct block* slot) {
+  uint64_t mask = num_slots - 1;
+  uint64_t hole = slot - blocks;
+  slot->address = 0;
+  for (uint64_t i = (hole + 1) & mask; blocks[i].address != 0; i = (i + 1) & mask) {
+    uint64_t home = hash(blocks[i].address) & mask;
+    // the entry may fill the hole if its home is not between the hole and it
+    if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+      blocks[hole] = blocks[i];
+      blocks[i].address = 0;
+      hole = i;
+    }
+  }
+  num_blocks--;
+}
+
+static int find_site(uint64_t caller) {
+  if (2 * (num_sites + 1) > num_site_slots) {
+    free(site_slots);
+    num_site_slots = num_site_slots == 0 ? 256 : num_site_slots * 2;
+    site_slots = malloc(num_site_slots * sizeof(long));
+    memset(site_slots, -1, num_site_slots * sizeof(long));
+    for (long s = 0; s < num_sites; s++) {
+      uint64_t i = hash(sites[s].caller) & (num_site_slots - 1);
+      while (site_slots[i] != -1) {
+        i = (i + 1) & (num_site_slots - 1);
+      }
+      site_slots[i] = s;
+    }
+    sites = realloc(sites, num_site_slots / 2 * sizeof(struct site));
+  }
+  uint64_t i = hash(caller) & (num_site_slots - 1);
+  while (site_slots[i] != -1) {
+    if (sites[site_slots[i]].caller == caller) {
+      return site_slots[i];
+    }
+    i = (i + 1) & (num_site_slots - 1);
+  }
+  site_slots[i] = num_sites;
+  memset(&sites[num_sites], 0, sizeof(struct site));
+  sites[num_sites].caller = caller;
+  return num_sites++;
+}
+
+static int by_time(const void* a, const void* b) {
+  const struct mylloc_trace_record* x = a;
+  const struct mylloc_trace_record* y = b;
+  return x->time < y->time ? -1 : x->time > y->time;
+}
+
+static int by_live(const void* a, const void* b) {
+  const struct site* x = a;
+  const struct site* y = b;
+  return x->live < y->live ? 1 : x->live > y->live ? -1 : 0;
+}
+
+static struct mylloc_trace_record* read_trace(const char* filename, long* count) {
+  FILE* infile = fopen(filename, "rb");
+  if (infile == NULL) {
+    printf("Cannot open %s\n", filename);
+    return NULL;
+  }
+  char magic[sizeof(MYLLOC_TRACE_MAGIC) - 1];
+  if (fread(magic, sizeof(magic), 1, infile) != 1 || memcmp(magic, MYLLOC_TRACE_MAGIC, sizeof(magic)) != 0) {
+    printf("%s is not a mylloc trace\n", filename);
+    fclose(infile);
+    return NULL;
+  }
+  long capacity = 4096;
+  struct mylloc_trace_record* records = malloc(capacity * sizeof(struct mylloc_trace_record));
+  *count = 0;
+  size_t got;
+  while ((got = fread(records + *count, sizeof(struct mylloc_trace_record), capacity - *count, infile)) > 0) {
+    *count += got;
+    if (*count == capacity) {
+      capacity *= 2;
+      records = realloc(records, capacity * sizeof(struct mylloc_trace_record));
+    }
+  }
+  fclose(infile);
+  return records;
+}
+
+static int read_maps(const char* filename, struct mapping** maps) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.maps", filename);
+  FILE* infile = fopen(path, "r");
+  if (infile == NULL) {
+    return 0;
+  }
+  int count = 0;
+  int capacity = 64;
+  *maps = malloc(capacity * sizeof(struct mapping));
+  char line[512];
+  while (fgets(line, sizeof(line), infile) != NULL) {
+    struct mapping map;
+    char name[256] = "";
+    if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %" SCNx64 " %*s %*s %255s",
+               &map.start, &map.end, &map.offset, name) < 3 || name[0] != '/') {
+      continue;
+    }
+    char* base = strrchr(name, '/');
+    snprintf(map.name, sizeof(map.name), "%s", base + 1);
+    if (count == capacity) {
+      capacity *= 2;
+      *maps = realloc(*maps, capacity * sizeof(struct mapping));
+    }
+    (*maps)[count++] = map;
+  }
+  fclose(infile);
+  return count;
+}
+
+// prints a call site as file+offset, which addr2line -e file understands
+static void print_site(uint64_t caller, struct mapping* maps, int num_maps) {
+  for (int i = 0; i < num_maps; i++) {
+    if (caller >= maps[i].start && caller < maps[i].end) {
+      printf("%s+0x%" PRIx64 "\n", maps[i].name, caller - maps[i].start + maps[i].offset);
+      return;
+    }
+  }
+  printf("0x%" PRIx64 "\n", caller);
+}
+
+int main(int argc, char* argv[]) {
+  int top = 20;
+  int replay = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, ":n:r")) != -1) {
+    switch (opt) {
+      case 'n': top = atoi(optarg); break;
+      case 'r': replay = 1; break;
+      case '?': printf("usage: %s [-n sites] [-r] trace\n", argv[0]); return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    printf("usage: %s [-n sites] [-r] trace\n", argv[0]);
+    return 1;
+  }
+
+  long count;
+  struct mylloc_trace_record* records = read_trace(argv[optind], &count);
+  if (records == NULL) {
+    return 1;
+  }
+  // each thread wrote its records in order, but the buffers are interleaved
+  qsort(records, count, sizeof(struct mylloc_trace_record), by_time);
+
+  long live = 0;
+  long peak = 0;
+  uint64_t peak_time = 0;
+  long next_id = 0;
+  int max_thread = -1;
+  grow_blocks();
+
+  for (long r = 0; r < count; r++) {
+    struct mylloc_trace_record* record = &records[r];
+    if (record->thread > max_thread) {
+      max_thread = record->thread;
+    }
+    if (record->op == MYLLOC_TRACE_ALLOC) {
+      if (2 * (num_blocks + 1) > num_slots) {
+        grow_blocks();
+      }
+      struct block* block = find_block(record->address);
+      if (block->address == 0) {
+        num_blocks++;
+      } else {
+        // allocated again without a free we saw: drop the old owner
+        sites[block->site].live -= block->size;
+        sites[block->site].live_blocks--;
+        live -= block->size;
+      }
+      int s = find_site(record->caller);
+      block->address = record->address;
+      block->site = s;
+      block->size = record->size;
+      block->id = next_id++;
+      sites[s].allocs++;
+      sites[s].total += record->size;
+      sites[s].live += record->size;
+      sites[s].live_blocks++;
+      if (sites[s].live > sites[s].peak) {
+        sites[s].peak = sites[s].live;
+      }
+      live += record->size;
+      if (live > peak) {
+        peak = live;
+        peak_time = record->time;
+      }
+      if (replay) {
+        printf("a %ld %u\n", block->id, record->size);
+      }
+    } else if (record->op == MYLLOC_TRACE_FREE) {
+      struct block* block = find_block(record->address);
+      if (block->address == 0) {
+        continue;
+      }
+      sites[block->site].live -= block->size;
+      sites[block->site].live_blocks--;
+      live -= block->size;
+      if (replay) {
+        printf("f %ld\n", block->id);
+      }
+      remove_block(block);
+    }
+  }
+  if (replay) {
+    return 0;
+  }
+
+  struct mapping* maps = NULL;
+  int num_maps = read_maps(argv[optind], &maps);
+  double seconds = count > 0 ? (records[count - 1].time - records[0].time) / 1.e9 : 0;
+  printf("%ld records from %d threads over %.3f seconds\n", count, max_thread + 1, seconds);
+  printf("peak live: %ld bytes after %.3f seconds, at the end: %ld bytes in %ld blocks\n",
+         peak, count > 0 ? (peak_time - records[0].time) / 1.e9 : 0, live, num_blocks);
+
+  qsort(sites, num_sites, sizeof(struct site), by_live);
+  printf("%12s %8s %10s %12s %12s  %s\n", "live bytes", "blocks", "allocs", "total bytes", "peak bytes", "call site");
+  for (long s = 0; s < num_sites && s < top; s++) {
+    printf("%12ld %8ld %10ld %12ld %12ld  ", sites[s].live, sites[s].live_blocks,
+           sites[s].allocs, sites[s].total, sites[s].peak);
+    print_site(sites[s].caller, maps, num_maps);
+  }
+
+  free(records);
+  free(blocks);
+  free(sites);
+  free(site_slots);
+  free(maps);
+  return 0;
+}
@@ -4,13 +4,42 @@
 #include <time.h>
 #include <string.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <stdint.h>
+#include "mylloc.h"
+#include "slab.h"
 
-struct chunk {
-  int size;
-  int used;
-  struct chunk *next;
-};
-extern struct chunk* flist;
+#define THREADS 8
+#define SLOTS 256
+#define ROUNDS 200000
+
+// allocates and frees random sizes, checking that no block is overwritten
+void* churn(void* arg) {
+  unsigned seed = (unsigned) (size_t) arg;
+  unsigned char* slots[SLOTS] = {0};
+  size_t sizes[SLOTS];
+  long failed = 0;
+  for (int i = 0; i < ROUNDS; i++) {
+    seed = seed * 1103515245 + 12345;
+    int slot = (seed >> 8) % SLOTS;
+    if (slots[slot] != NULL) {
+      for (size_t j = 0; j < sizes[slot]; j++) {
+        failed |= slots[slot][j] != (unsigned char) slot;
+      }
+      free(slots[slot]);
+      slots[slot] = NULL;
+    } else {
+      sizes[slot] = 1 + (seed >> 16) % ((seed & 3) ? 256 : 4096);
+      slots[slot] = malloc(sizes[slot]);
+      memset(slots[slot], slot, sizes[slot]);
+    }
+  }
+  for (int slot = 0; slot < SLOTS; slot++) {
+    free(slots[slot]);
+  }
+  return (void*) failed;
+}
 
 void check(int expr, const char* message) {
   if (!expr) {
@@ -22,53 +51,261 @@ void check(int expr, const char* message) {
   }
 }
 
+// runs churn on THREADS threads and returns non-zero if any saw a block overwritten
+long churn_threads() {
+  pthread_t threads[THREADS];
+  for (long i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, churn, (void*) (i + 1));
+  }
+  long failed = 0;
+  for (int i = 0; i < THREADS; i++) {
+    void* result;
+    pthread_join(threads[i], &result);
+    failed |= (long) result;
+  }
+  return failed;
+}
+
 int main (int argc, char* argv[]) {
 
   printf("Running tests...\n");
 
-  void *current;
-  void *init = sbrk(0);
+  // the first tests look at the central heap, so keep chunks out of the thread cache
+  mylloc_tcache_count = 0;
 
   free(0); // shouldn't crash
-  void* empty = malloc(0); // should return null
-  check(empty == 0, "test 1: size 0 returns NULL");
-  check(flist == 0, "test 2: flist is NULL to start");
+  void* empty = malloc(0); // should return a block of its own
+  void* empty2 = malloc(0);
+  check(empty != 0 && empty2 != 0 && empty != empty2, "test 1: size 0 returns a unique block");
+  check(binmap == 0, "test 2: bins are empty to start");
+
+  void *current;
+  void *init = sbrk(0);
 
   void *request1 = malloc(sizeof(char)*32);
   current = sbrk(0);
-  check(flist == 0, "test 3: flist is empty after first malloc");
-  check((current-init) == 32+16, "test 4: correct amount allocated");
+  check(binmap == 0, "test 3: bins are empty after first malloc");
+  check((current-init) == 48, "test 4: correct amount allocated");
 
   struct chunk* header1 = (struct chunk*) ((struct chunk*) request1 - 1);
-  check(header1->size == 32, "test 5: header size correct");
-  check(header1->used == 32, "test 6: header used correct");
+  check(MYLLOC_SIZE(header1) == 48 && ((uintptr_t) request1 & 15) == 0, "test 5: header size correct");
+  check((header1->head & MYLLOC_FLAGS) == (MYLLOC_INUSE | MYLLOC_PREV_INUSE) &&
+        malloc_usable_size(request1) == 40, "test 6: header flags correct");
 
   free(request1);
-  check(flist != 0, "test 7: flist is non-empty after free");
+  check(bins[mylloc_bin(48)] == header1, "test 7: chunk is in the 48 byte bin after free");
 
   request1 = malloc(sizeof(char) * 16);
   current = sbrk(0);
-  check(flist == 0, "test 8: flist is empty");
-  check((current-init) == 32+16, "test9: correct amount allocated");
+  check(binmap == 0, "test 8: bins are empty (48 byte chunk reused for 16 bytes)");
+  check((current-init) == 48, "test9: correct amount allocated");
 
   header1 = (struct chunk*) ((struct chunk*) request1 - 1);
-  check(header1->size == 32, "test 10: header size correct");
-  check(header1->used == 16, "test 11: header used correct");
+  check(MYLLOC_SIZE(header1) == 48, "test 10: header size correct");
+  check(header1->head & MYLLOC_INUSE, "test 11: header in use correct");
   free(request1);
   
   void* request2 = malloc(sizeof(char) * 64);
   current = sbrk(0);
-  check(flist != 0, "test 12: flist is not empty");
-  check((current-init) == 32+2*16+64, "test 13: current-init correct size");
+  check(request2 == request1 && binmap == 0, "test 12: free top chunk is grown in place");
+  check((current-init) == 80, "test 13: current-init correct size");
   
   struct chunk* header2 = (struct chunk*) ((struct chunk*) request2 - 1);
-  check(header2->size == 64, "test 14: header size correct");
-  check(header2->used == 64, "test 15: header used correct");
+  check(MYLLOC_SIZE(header2) == 80, "test 14: header size correct");
+  check(malloc_usable_size(request2) == 72, "test 15: usable size correct");
 
   free(request2);
-  check(flist->size == 64, "test 16: flist's first node has correct size");
-  check(flist->next != 0, "test 17: flist is non-empty");
-  check(flist->next->size == 32, "test 18: flist's second node has correct size");
+  check(bins[mylloc_bin(80)] == header2, "test 16: 80 byte bin holds the freed chunk");
+
+  void* request3 = malloc(sizeof(char) * 16);
+  struct chunk* header3 = (struct chunk*) ((struct chunk*) request3 - 1);
+  check(header3 == header2 && MYLLOC_SIZE(header3) == 32, "test 17: 80 byte chunk is split for 16 bytes");
+  check(bins[mylloc_bin(48)] != 0 && MYLLOC_SIZE(bins[mylloc_bin(48)]) == 48,
+        "test 18: the rest of the split chunk is in the 48 byte bin");
+
+  free(request3);
+  check(bins[mylloc_bin(80)] == header3 && MYLLOC_SIZE(bins[mylloc_bin(80)]) == 80 && bins[mylloc_bin(48)] == 0,
+        "test 19: freed chunk is merged with the free chunk above it");
+
+  void* a = malloc(48);
+  void* b = malloc(48);
+  void* c = malloc(48);
+  void* guard = malloc(16);
+  struct chunk* header_a = (struct chunk*) a - 1;
+  struct chunk* header_b = (struct chunk*) b - 1;
+  size_t size_a = MYLLOC_SIZE(header_a);
+  free(a);
+  free(c);
+  check(header_b->prev_size == size_a && !(header_b->head & MYLLOC_PREV_INUSE),
+        "test 20: boundary tag records the free chunk below");
+  free(b);
+  check(bins[mylloc_bin(size_a+64+64)] == header_a &&
+        MYLLOC_SIZE(bins[mylloc_bin(size_a+64+64)]) == size_a+64+64 &&
+        bins[mylloc_bin(64)] == 0 && bins[mylloc_bin(size_a)] == 0,
+        "test 21: chunk is merged with free chunks on both sides");
+  free(guard);
+
+  void* large1 = malloc(1024);
+  void* guard1 = malloc(16);
+  void* large2 = malloc(2048);
+  void* guard2 = malloc(16);
+  void* large3 = malloc(1536);
+  void* guard3 = malloc(16);
+  free(large1);
+  free(large2);
+  free(large3);
+  unsigned long searches = mylloc_tree_searches;
+  void* best = malloc(1500);
+  check(best == large3 && mylloc_tree != NULL && mylloc_tree_searches == searches + 1,
+        "test 22: tree gives the best fitting large chunk");
+  free(best);
+  free(guard1);
+  free(guard2);
+  free(guard3);
+
+  void* brk = sbrk(0);
+  void* huge = malloc(1 << 20);
+  struct chunk* huge_header = (struct chunk*) huge - 1;
+  check(huge != NULL && (huge_header->head & MYLLOC_MMAPPED) && sbrk(0) == brk,
+        "test 23: huge allocation is mapped outside the heap");
+  free(huge);
+
+  void* top1 = malloc(100000);
+  void* top2 = malloc(100000);
+  void* grown = sbrk(0);
+  free(top1);
+  free(top2);
+  check(sbrk(0) < grown && (char*) grown - (char*) sbrk(0) > 150000,
+        "test 24: free space at the top of the heap is given back");
+
+  char* grow = malloc(100);
+  void* blocker = malloc(200);
+  void* after = malloc(16);
+  memset(grow, 'x', 100);
+  free(blocker);
+  char* grown_in_place = realloc(grow, 250);
+  check(grown_in_place == grow && grown_in_place[99] == 'x' && malloc_usable_size(grown_in_place) >= 250,
+        "test 25: realloc grows into the free chunk above");
+  free(grown_in_place);
+  free(after);
+
+  int* zeroed = malloc(64 * sizeof(int));
+  memset(zeroed, 0xff, 64 * sizeof(int));
+  free(zeroed);
+  zeroed = calloc(64, sizeof(int));
+  int nonzero = 0;
+  for (int i = 0; i < 64; i++) {
+    nonzero |= zeroed[i];
+  }
+  size_t count = SIZE_MAX / 8;
+  check(nonzero == 0 && calloc(count, 16) == NULL, "test 26: calloc clears reused memory and checks overflow");
+  free(zeroed);
+
+  void* aligned = NULL;
+  int status = posix_memalign(&aligned, 4096, 1000);
+  void* aligned64 = aligned_alloc(64, 64);
+  check(status == 0 && ((size_t) aligned & 4095) == 0 && ((size_t) aligned64 & 63) == 0 &&
+        malloc_usable_size(aligned) >= 1000, "test 27: aligned allocations are aligned");
+  free(aligned);
+  free(aligned64);
+
+  void* small_blocks[100];
+  int aligned_small = 1;
+  for (int i = 0; i < 100; i++) {
+    small_blocks[i] = malloc(i + 1);
+    aligned_small &= ((uintptr_t) small_blocks[i] & 15) == 0;
+  }
+  check(aligned_small && (char*) small_blocks[23] - (char*) small_blocks[22] == 32,
+        "test 28: small blocks are aligned and a 24 byte block takes 32 bytes");
+  for (int i = 0; i < 100; i++) {
+    free(small_blocks[i]);
+  }
+
+  struct mylloc_stats before_stats, after_stats;
+  mylloc_stats(&before_stats);
+  void* counted = malloc(1000);
+  void* counted_huge = malloc(1 << 20);
+  mylloc_stats(&after_stats);
+  size_t counted_size = malloc_usable_size(counted);
+  check(after_stats.in_use == before_stats.in_use + counted_size + malloc_usable_size(counted_huge) &&
+        after_stats.in_use_blocks == before_stats.in_use_blocks + 2 &&
+        after_stats.histogram[mylloc_size_class(counted_size)] ==
+          before_stats.histogram[mylloc_size_class(counted_size)] + 1 &&
+        after_stats.mapped >= before_stats.mapped + (1 << 20) &&
+        after_stats.peak_in_use >= after_stats.in_use, "test 29: stats count blocks as they are allocated");
+  free(counted);
+  free(counted_huge);
+  mylloc_stats(&after_stats);
+  check(after_stats.in_use == before_stats.in_use && after_stats.mapped == before_stats.mapped &&
+        after_stats.free >= 1000, "test 30: stats count blocks as they are freed");
+
+  mylloc_tcache_count = MYLLOC_TCACHE_COUNT;
+  void* cached = malloc(100);
+  unsigned long long before = binmap;
+  free(cached);
+  check(malloc(100) == cached && binmap == before, "test 31: thread cache reuses small chunks");
+
+  check(churn_threads() == 0, "test 32: threads allocating at once do not overlap");
+  // the first threads leave some of the C library's own blocks behind for reuse
+  mylloc_stats(&before_stats);
+  churn_threads();
+  mylloc_stats(&after_stats);
+  // blocks the C library keeps may be reallocated into chunks with a few bytes
+  // more or less to spare, so count blocks rather than bytes
+  check(after_stats.in_use_blocks == before_stats.in_use_blocks, "test 33: stats add up after threads exit");
+
+  struct slab_pool* pool = slab_create(80);
+  void* first = slab_alloc(pool);
+  void* second = slab_alloc(pool);
+  int packed = (char*) second - (char*) first == 80 && ((uintptr_t) first & (SLAB_ALIGN - 1)) == 0;
+  slab_free(pool, first);
+  int reused = slab_alloc(pool) == first;
+  for (int i = 0; i < 1000; i++) {
+    slab_alloc(pool);
+  }
+  size_t slabs = pool->slab_count;
+  slab_reset(pool);
+  void* again = slab_alloc(pool);
+  for (int i = 0; i < 1001; i++) {
+    slab_alloc(pool);
+  }
+  check(packed && reused && again == first && pool->slab_count == slabs && pool->in_use == 1002,
+        "test 34: slab pool packs, reuses and resets objects");
+  slab_destroy(pool);
+
+  // The threads above leave free chunks in the heap, so two blocks in a row
+  // need not sit next to each other: allocate until two do. Blocks this big
+  // skip the thread caches, so freeing one goes straight back to the heap.
+  int clean = mylloc_check() == 0;
+  void* blocks[64];
+  int allocated = 0;
+  struct chunk* below_header = NULL;
+  struct chunk* above_header = NULL;
+  while (above_header == NULL && allocated < 64) {
+    blocks[allocated++] = malloc(1000);
+    struct chunk* last = (struct chunk*) blocks[allocated - 1] - 1;
+    if (below_header != NULL && (char*) below_header + MYLLOC_SIZE(below_header) == (char*) last) {
+      above_header = last;
+    } else {
+      below_header = last;
+    }
+  }
+  int caught = 0;
+  if (above_header != NULL) {
+    free(below_header + 1);
+    above_header->head |= MYLLOC_PREV_INUSE;
+    printf("(the next line is the error test 35 expects)\n");
+    caught = mylloc_check() > 0;
+    above_header->head &= ~(size_t) MYLLOC_PREV_INUSE;
+  }
+  check(clean && caught && mylloc_check() == 0, "test 35: heap check passes, and notices a broken tag");
+  for (int i = 0; i < allocated; i++) {
+    if (blocks[i] != below_header + 1) {
+      free(blocks[i]);
+    }
+  }
 
+  free(empty);
+  free(empty2);
   return 0 ;
 }